@@ -0,0 +1,46 @@
+TEMPLATE = app
+
+TARGET = benchmarks
+
+QT += qml quick testlib concurrent
+
+CONFIG += c++11 console testcase
+CONFIG -= app_bundle
+
+##
+## Compiler settings
+##
+
+    OBJECTS_DIR = obj
+    MOC_DIR     = moc
+
+    # SDL 2
+    win32: CONFIG -= windows
+    win32: QMAKE_LFLAGS += $$QMAKE_LFLAGS_WINDOWS
+
+    # Include libraries
+    win32: INCLUDEPATH += C:/msys64/mingw64/include C:/msys64/mingw64/include/SDL2 # MSYS2
+    macx:  INCLUDEPATH += /usr/local/include /usr/local/include/SDL2               # Homebrew
+    macx:  INCLUDEPATH += /usr/local/include /opt/local/include/SDL2               # MacPorts
+    unix:  INCLUDEPATH += /usr/include /usr/include/SDL2                           # Linux
+
+INCLUDEPATH += ../backend ../backend/input
+
+SOURCES += inputbenchmark.cpp
+
+##
+## Linker settings
+##
+
+    # Our stuff
+    LIBS += -L../backend
+    TARGETDEPS += ../backend/libphoenix-backend.a
+    LIBS += -lphoenix-backend
+
+    # SDL2
+    macx: LIBS += -L/usr/local/lib -L/opt/local/lib # Homebrew, MacPorts
+    win32: LIBS += -lmingw32 -lSDL2main
+    LIBS += -lSDL2
+
+    # Other libraries we use
+    LIBS += -lsamplerate -lz
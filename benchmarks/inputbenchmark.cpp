@@ -0,0 +1,1099 @@
+#include <QtTest>
+#include <QCoreApplication>
+#include <QTemporaryDir>
+#include <QVector>
+
+#include <SDL.h>
+
+#include <atomic>
+#include <cstring>
+
+#if defined( Q_OS_LINUX )
+#include <unistd.h>
+#endif
+
+#include "inputdevice.h"
+#include "inputdeviceevent.h"
+#include "inputeventqueue.h"
+#include "inputlayout.h"
+#include "inputmanager.h"
+#include "inputrecording.h"
+#include "inputthread.h"
+#include "joystick.h"
+#include "keyboard.h"
+#include "profilestore.h"
+#include "qmlinputdevice.h"
+#include "sdleventloop.h"
+#include "seqlock.h"
+#include "virtualjoystick.h"
+
+// Microbenchmarks for the input path, from a single insert() up to a whole poll tick.
+
+// The results are meant to be tracked across releases, use QtTest's machine readable output for that:
+//     ./benchmarks -o results.xml,xml
+//     ./benchmarks -o results.csv,csv
+
+// hotplugSoak plugs pads in and out for BENCHMARK_SOAK_SECONDS (10 by default) while the input thread polls,
+// and fails if the device bookkeeping ever disagrees with itself.
+
+// The SDL benchmarks plug in VirtualJoysticks instead of relying on real controllers, they're skipped if
+// VirtualJoystick isn't supported.
+
+//
+// Allocation counting
+//
+
+// With glibc the executable can wrap malloc() itself, which catches both Qt's containers and operator new.
+#if defined( Q_OS_LINUX ) && defined( __GLIBC__ )
+#define BENCHMARK_COUNTS_ALLOCATIONS
+
+static std::atomic<quint64> allocationCount( 0 );
+
+extern "C" {
+
+    void *__libc_malloc( size_t size );
+    void *__libc_calloc( size_t count, size_t size );
+    void *__libc_realloc( void *pointer, size_t size );
+
+    void *malloc( size_t size ) noexcept {
+        allocationCount.fetch_add( 1, std::memory_order_relaxed );
+        return __libc_malloc( size );
+    }
+
+    void *calloc( size_t count, size_t size ) noexcept {
+        allocationCount.fetch_add( 1, std::memory_order_relaxed );
+        return __libc_calloc( count, size );
+    }
+
+    void *realloc( void *pointer, size_t size ) noexcept {
+        allocationCount.fetch_add( 1, std::memory_order_relaxed );
+        return __libc_realloc( pointer, size );
+    }
+
+}
+
+#endif
+
+//
+// Helpers
+//
+
+// Resident set size in bytes, -1 if the platform doesn't say.
+static qint64 residentBytes() {
+
+#if defined( Q_OS_LINUX )
+    QFile statm( "/proc/self/statm" );
+
+    if( !statm.open( QIODevice::ReadOnly ) ) {
+        return -1;
+    }
+
+    QList<QByteArray> fields = statm.readAll().split( ' ' );
+    return fields.size() > 1 ? fields.at( 1 ).toLongLong() * sysconf( _SC_PAGESIZE ) : -1;
+#else
+    return -1;
+#endif
+
+}
+
+// What the recording tests record for 'port' on 'frame'. Port 0 changes every frame, with axes moving both
+// ways and by more than a byte's worth, port 1 only now and then.
+static InputState recordedState( const int port, const quint64 frame ) {
+
+    InputState state;
+
+    if( port == 0 ) {
+        state.buttons = static_cast<quint32>( frame * 2654435761u ) & 0xffff;
+        state.axes[ InputState::LeftX ] = static_cast<int16_t>( frame * 37 );
+        state.axes[ InputState::LeftY ] = static_cast<int16_t>( -static_cast<qint64>( frame ) * 1021 );
+        state.axes[ InputState::RightTrigger ] = static_cast<int16_t>( ( frame % 2 ) * 32767 );
+    }
+
+    else if( ( frame / 7 ) % 2 ) {
+        state.buttons = InputState::mask( InputDeviceEvent::Start );
+        state.axes[ InputState::RightY ] = -32768;
+    }
+
+    return state;
+
+}
+
+// Records 'frames' frames of recordedState() for two ports to 'path'.
+static bool recordFrames( const QString &path, const quint64 frames ) {
+
+    InputRecorder recorder;
+
+    if( !recorder.start( path, 2 ) ) {
+        return false;
+    }
+
+    InputState states[ 2 ];
+
+    for( quint64 frame = 0; frame < frames; ++frame ) {
+        states[ 0 ] = recordedState( 0, frame );
+        states[ 1 ] = recordedState( 1, frame );
+        recorder.record( states );
+    }
+
+    recorder.finish();
+    return recorder.frameCount() == frames;
+
+}
+
+static bool sameState( const InputState &a, const InputState &b ) {
+    return a.buttons == b.buttons && std::memcmp( a.axes, b.axes, sizeof( a.axes ) ) == 0;
+}
+
+// Writes to a SeqLock as fast as it can, from whatever thread it's moved to.
+class SeqLockWriter : public QObject {
+        Q_OBJECT
+
+    public:
+
+        explicit SeqLockWriter( SeqLock<InputState> *lock )
+            : lock( lock ),
+              running( true ) {
+        }
+
+        void finish() {
+            running.store( false, std::memory_order_relaxed );
+        }
+
+    public slots:
+
+        void run() {
+
+            InputState state;
+
+            while( running.load( std::memory_order_relaxed ) ) {
+                state.buttons ^= InputState::mask( InputDeviceEvent::A );
+                state.axes[ InputState::LeftX ]++;
+                lock->store( state );
+            }
+
+        }
+
+    private:
+
+        SeqLock<InputState> *lock;
+        std::atomic<bool> running;
+
+};
+
+// Reads a SeqLock a fixed number of times, from whatever thread it's moved to.
+class SeqLockReader : public QObject {
+        Q_OBJECT
+
+    public:
+
+        explicit SeqLockReader( SeqLock<InputState> *lock )
+            : lock( lock ),
+              elapsed( 0 ) {
+        }
+
+        qint64 nsecsElapsed() const {
+            return elapsed;
+        }
+
+    public slots:
+
+        void run( int count ) {
+
+            quint32 buttons = 0;
+
+            QElapsedTimer timer;
+            timer.start();
+
+            for( int i = 0; i < count; ++i ) {
+                buttons ^= lock->load().buttons;
+            }
+
+            elapsed = timer.nsecsElapsed();
+
+            Q_UNUSED( buttons );
+
+        }
+
+    private:
+
+        SeqLock<InputState> *lock;
+        qint64 elapsed;
+
+};
+
+// An SDLEventLoop that has opened 'count' VirtualJoysticks.
+class VirtualPads {
+
+    public:
+
+        VirtualPads()
+            : eventLoop( nullptr ) {
+        }
+
+        ~VirtualPads() {
+            clear();
+        }
+
+        bool attach( const int count ) {
+
+            eventLoop = new SDLEventLoop;
+            eventLoop->setEventQueues( &frontendQueue, nullptr );
+
+            QObject::connect( eventLoop, &SDLEventLoop::deviceConnected, [ this ]( Joystick * joystick ) {
+                joysticks.append( joystick );
+            } );
+
+            eventLoop->attachVirtualJoysticks( count );
+
+            if( eventLoop->virtualJoystickCount() != count ) {
+                return false;
+            }
+
+            // Sees every SDL_JOYDEVICEADDED and starts opening the devices.
+            eventLoop->pollEvents();
+
+            QElapsedTimer timeout;
+            timeout.start();
+
+            while( joysticks.size() < count && timeout.elapsed() < 10000 ) {
+                QCoreApplication::processEvents( QEventLoop::AllEvents, 10 );
+            }
+
+            return joysticks.size() == count;
+
+        }
+
+        void clear() {
+
+            // Detaches the VirtualJoysticks, but the Joysticks are ours to delete.
+            delete eventLoop;
+            eventLoop = nullptr;
+
+            qDeleteAll( joysticks );
+            joysticks.clear();
+
+            SDL_FlushEvents( SDL_FIRSTEVENT, SDL_LASTEVENT );
+
+            InputEventList events;
+            frontendQueue.drain( events );
+
+        }
+
+        // Presses or releases A on the first pad, so a tick has an edge to deliver.
+        void toggleButton( const bool pressed ) {
+            eventLoop->virtualJoystick( 0 )->setButton( SDL_CONTROLLER_BUTTON_A, pressed );
+        }
+
+        SDLEventLoop *eventLoop;
+        QVector<Joystick *> joysticks;
+        InputEventQueue frontendQueue;
+
+};
+
+//
+// Benchmarks
+//
+
+class InputBenchmark : public QObject {
+        Q_OBJECT
+
+    private slots:
+
+        void initTestCase();
+
+        // InputDevice
+        void inputDeviceInsert();
+        void inputDeviceValue();
+        void inputDeviceValueContended();
+        void inputDeviceSlowAxisEmits();
+
+        // Keyboard
+        void keyboardInsert();
+        void keyboardLookup();
+        void keyboardMultipleEvents();
+
+        // ProfileStore
+        void profileStoreFind();
+        void profileStoreRoundTrip();
+        void controllerMappingProfile();
+        void controllerMappingRead();
+
+        // InputRecorder and InputReplay
+        void inputRecordingRoundTrip();
+        void inputRecordingTruncated();
+
+        // QMLInputDevice
+        void qmlInputDeviceInsert();
+        void qmlInputDeviceInsertBatch();
+        void qmlInputDeviceHeldByAnyDevice();
+
+        // InputDeviceEvent
+        void inputDeviceEventToEvent();
+        void inputDeviceEventToString();
+        void inputDeviceEventMatchesSDL();
+        void inputDeviceEventLegacyNames();
+
+        // InputLayout
+        void inputLayoutTranslate_data();
+        void inputLayoutTranslate();
+
+        // Joystick and SDLEventLoop
+        void joystickLoadSDLMapping();
+        void pollTick_data();
+        void pollTick();
+        void pollTickDoesNotAllocate();
+
+        // InputManager
+        void hotplugSoak();
+
+};
+
+void InputBenchmark::initTestCase() {
+
+    // Keep saveMapping() and friends away from the user's settings.
+    QCoreApplication::setOrganizationName( "Phoenix" );
+    QCoreApplication::setApplicationName( "Phoenix Benchmarks" );
+
+    // Emission to the frontend is part of what's being measured.
+    InputDevice::gamepadControlsFrontend.store( true, std::memory_order_relaxed );
+
+}
+
+void InputBenchmark::inputDeviceInsert() {
+
+    InputDevice device;
+    int16_t state = 0;
+
+    QBENCHMARK {
+        state ^= 1;
+        device.insert( InputDeviceEvent::A, state );
+
+        // L2 has an analog slot, so this also covers the axis path.
+        device.insert( InputDeviceEvent::L2, state ? 20000 : 0 );
+        device.publishStates();
+    }
+
+}
+
+void InputBenchmark::inputDeviceValue() {
+
+    InputDevice device;
+    device.insert( InputDeviceEvent::A, 1 );
+    device.publishStates();
+
+    int16_t sum = 0;
+
+    QBENCHMARK {
+        sum += device.value( InputDeviceEvent::A );
+    }
+
+    QVERIFY( sum != 0 );
+
+}
+
+void InputBenchmark::inputDeviceValueContended() {
+
+    if( QThread::idealThreadCount() < 2 ) {
+        QSKIP( "Needs at least two cores" );
+    }
+
+    SeqLock<InputState> lock;
+    SeqLockWriter writer( &lock );
+    SeqLockReader reader( &lock );
+
+    // QBENCHMARK can't move the test thread, so both sides get an InputThread pinned to a core of their own.
+    InputThread writerThread;
+    writerThread.setAffinity( 1 );
+    writer.moveToThread( &writerThread );
+    writerThread.start();
+
+    InputThread readerThread;
+    readerThread.setAffinity( 0 );
+    reader.moveToThread( &readerThread );
+    readerThread.start();
+
+    QMetaObject::invokeMethod( &writer, "run", Qt::QueuedConnection );
+
+    const int count = 1000000;
+    QMetaObject::invokeMethod( &reader, "run", Qt::BlockingQueuedConnection, Q_ARG( int, count ) );
+
+    writer.finish();
+    writerThread.quit();
+    readerThread.quit();
+    writerThread.wait();
+    readerThread.wait();
+
+    // A million loads in milliseconds, which reads as nanoseconds per load.
+    QTest::setBenchmarkResult( reader.nsecsElapsed() / 1000000.0, QTest::WalltimeMilliseconds );
+
+}
+
+void InputBenchmark::inputDeviceSlowAxisEmits() {
+
+    InputDevice device;
+    QList<int> emitted;
+
+    connect( &device, &InputDevice::inputDeviceEvent, [ &emitted ]( InputDeviceEvent::Event, int state ) {
+        emitted.append( state );
+    } );
+
+    // Never more than axisEventThreshold per step, but far more than that in total.
+    for( int16_t state = 1000; state <= 10000; state += 1000 ) {
+        device.insert( InputDeviceEvent::L2, state );
+    }
+
+    // The press, then once the trigger is axisEventThreshold away from it.
+    QCOMPARE( emitted, QList<int>() << 1000 << 6000 );
+
+}
+
+void InputBenchmark::keyboardInsert() {
+
+    // Resetting loads the default mapping, without touching the settings file.
+    Keyboard keyboard;
+    keyboard.setResetMapping( true );
+
+    int16_t pressed = 0;
+
+    QBENCHMARK {
+        pressed ^= 1;
+        keyboard.insert( Qt::Key_A, pressed );
+    }
+
+}
+
+void InputBenchmark::keyboardLookup() {
+
+    Keyboard keyboard;
+    keyboard.setResetMapping( true );
+
+    // One Latin-1 key, one special key, one unmapped key.
+    const int keys[] = { Qt::Key_A, Qt::Key_Up, Qt::Key_VolumeUp };
+    quint32 buttons = 0;
+    int i = 0;
+
+    QBENCHMARK {
+        buttons |= keyboard.buttonsForKey( keys[ i ] );
+        i = ( i + 1 ) % 3;
+    }
+
+    QCOMPARE( buttons, InputState::mask( InputDeviceEvent::A ) | InputState::mask( InputDeviceEvent::Up ) );
+
+}
+
+void InputBenchmark::keyboardMultipleEvents() {
+
+    Keyboard keyboard;
+
+    InputDeviceMapping mapping;
+    mapping.insert( Qt::Key_Space, InputDeviceEvent::A );
+    mapping.insert( Qt::Key_Space, InputDeviceEvent::B );
+    mapping.insert( Qt::Key_VolumeUp, InputDeviceEvent::Start );
+    keyboard.setKeyMapping( mapping );
+
+    keyboard.insert( Qt::Key_Space, 1 );
+    keyboard.insert( Qt::Key_VolumeUp, 1 );
+
+    InputState state = keyboard.snapshot();
+    QVERIFY( state.isPressed( InputDeviceEvent::A ) );
+    QVERIFY( state.isPressed( InputDeviceEvent::B ) );
+    QVERIFY( state.isPressed( InputDeviceEvent::Start ) );
+
+    keyboard.insert( Qt::Key_Space, 0 );
+    QCOMPARE( keyboard.snapshot().buttons, InputState::mask( InputDeviceEvent::Start ) );
+
+}
+
+void InputBenchmark::profileStoreFind() {
+
+    ProfileStore &store = ProfileStore::instance();
+    store.save( "benchmark", QByteArray( 128, 'x' ) );
+    store.flush();
+
+    int size = 0;
+
+    QBENCHMARK {
+        size += store.find( "benchmark" ).size();
+    }
+
+    Q_UNUSED( size );
+
+    store.remove( "benchmark" );
+    store.flush();
+
+}
+
+void InputBenchmark::profileStoreRoundTrip() {
+
+    ProfileStore &store = ProfileStore::instance();
+    QByteArray first( "first profile" );
+    QByteArray second( "second profile" );
+
+    // Visible right away, before the writer gets to it.
+    store.save( "round trip", first );
+    QCOMPARE( store.find( "round trip" ), first );
+
+    store.save( "round trip", second );
+    store.flush();
+    QCOMPARE( store.find( "round trip" ), second );
+
+    store.remove( "round trip" );
+    QVERIFY( store.find( "round trip" ).isEmpty() );
+
+    store.flush();
+    QVERIFY( store.find( "round trip" ).isEmpty() );
+
+}
+
+void InputBenchmark::controllerMappingProfile() {
+
+    ControllerMapping saved;
+    saved.clear();
+    saved.buttons[ SDL_CONTROLLER_BUTTON_A ] = 3;
+    saved.buttonAxisMask = 1u << SDL_CONTROLLER_AXIS_TRIGGERLEFT;
+
+    ControllerMapping loaded;
+    loaded.clear();
+    QVERIFY( loaded.fromProfile( saved.toProfile() ) );
+    QCOMPARE( loaded.buttons[ SDL_CONTROLLER_BUTTON_A ], saved.buttons[ SDL_CONTROLLER_BUTTON_A ] );
+    QCOMPARE( loaded.buttonAxisMask, saved.buttonAxisMask );
+
+    // A bare mapping, like older versions saved, and one from another version are both left alone.
+    QByteArray unversioned( reinterpret_cast<const char *>( &saved ), sizeof( ControllerMapping ) );
+    QByteArray otherVersion = saved.toProfile();
+    otherVersion.data()[ 7 ] = '0';
+
+    loaded.clear();
+    QVERIFY( !loaded.fromProfile( unversioned ) );
+    QVERIFY( !loaded.fromProfile( otherVersion ) );
+    QCOMPARE( loaded.buttons[ SDL_CONTROLLER_BUTTON_A ], static_cast<qint16>( -1 ) );
+
+}
+
+namespace {
+
+    // A raw device with one hat, buttons 0..7 and axes 0..3.
+    struct FakeRawJoystick {
+
+        quint8 buttons[ 8 ];
+        quint8 hats[ 1 ];
+        qint16 axes[ 4 ];
+
+        quint8 button( const int index ) const {
+            return index < 8 ? buttons[ index ] : 0;
+        }
+
+        quint8 hat( const int index ) const {
+            return index < 1 ? hats[ index ] : 0;
+        }
+
+        qint16 axis( const int index ) const {
+            return index < 4 ? axes[ index ] : 0;
+        }
+
+    };
+
+}
+
+void InputBenchmark::controllerMappingRead() {
+
+    ControllerMapping mapping;
+    mapping.clear();
+    mapping.buttons[ SDL_CONTROLLER_BUTTON_A ] = 2;
+    mapping.buttons[ SDL_CONTROLLER_BUTTON_B ] = 9;
+    mapping.hats[ SDL_CONTROLLER_BUTTON_DPAD_UP ] = ( 0 << 8 ) | 1;
+    mapping.axes[ SDL_CONTROLLER_AXIS_LEFTX ] = 1;
+    mapping.axes[ SDL_CONTROLLER_AXIS_TRIGGERLEFT ] = 3;
+    mapping.axes[ SDL_CONTROLLER_AXIS_TRIGGERRIGHT ] = 2;
+    mapping.buttonAxisMask = 1u << SDL_CONTROLLER_AXIS_TRIGGERRIGHT;
+
+    FakeRawJoystick device = {};
+    device.buttons[ 2 ] = 1;
+    device.hats[ 0 ] = 1 | 2;
+    device.axes[ 1 ] = -20000;
+    device.axes[ 3 ] = 12345;
+
+    JoystickState state = mapping.read( device );
+    QVERIFY( state.isPressed( SDL_CONTROLLER_BUTTON_A ) );
+    QVERIFY( !state.isPressed( SDL_CONTROLLER_BUTTON_B ) );
+    QVERIFY( state.isPressed( SDL_CONTROLLER_BUTTON_DPAD_UP ) );
+    QVERIFY( !state.isPressed( SDL_CONTROLLER_BUTTON_X ) );
+    QCOMPARE( state.axis( SDL_CONTROLLER_AXIS_LEFTX ), static_cast<qint16>( -20000 ) );
+    QCOMPARE( state.axis( SDL_CONTROLLER_AXIS_TRIGGERLEFT ), static_cast<qint16>( 12345 ) );
+    QCOMPARE( state.axis( SDL_CONTROLLER_AXIS_TRIGGERRIGHT ), static_cast<qint16>( 1 ) );
+
+    // Digital triggers read raw buttons, button 3 isn't pressed.
+    state = mapping.read( device, true );
+    QCOMPARE( state.axis( SDL_CONTROLLER_AXIS_TRIGGERLEFT ), static_cast<qint16>( 0 ) );
+    QCOMPARE( state.axis( SDL_CONTROLLER_AXIS_TRIGGERRIGHT ), static_cast<qint16>( 1 ) );
+
+}
+
+void InputBenchmark::inputRecordingRoundTrip() {
+
+    QTemporaryDir directory;
+    QVERIFY( directory.isValid() );
+
+    QString path = directory.filePath( "roundtrip.rec" );
+
+    // Enough for several chunks, whichever of the frame and byte limits closes them.
+    const quint64 frames = InputRecorder::chunkFrames * 2 + 100;
+    QVERIFY( recordFrames( path, frames ) );
+
+    InputReplay replay;
+    QVERIFY( replay.open( path ) );
+    QCOMPARE( replay.portCount(), 2 );
+
+    for( quint64 frame = 0; frame < frames; ++frame ) {
+
+        QVERIFY( replay.nextFrame() );
+
+        for( int port = 0; port < 2; ++port ) {
+            if( !sameState( replay.state( port ), recordedState( port, frame ) ) ) {
+                QFAIL( qPrintable( QString( "Port %1 differs on frame %2" ).arg( port ).arg( frame ) ) );
+            }
+        }
+
+    }
+
+    QCOMPARE( replay.frame(), frames );
+
+    // Over, every port is released.
+    QVERIFY( !replay.nextFrame() );
+    QVERIFY( sameState( replay.state( 0 ), InputState() ) );
+    QVERIFY( sameState( replay.state( 1 ), InputState() ) );
+
+}
+
+void InputBenchmark::inputRecordingTruncated() {
+
+    QTemporaryDir directory;
+    QVERIFY( directory.isValid() );
+
+    QString path = directory.filePath( "truncated.rec" );
+    const quint64 frames = InputRecorder::chunkFrames * 2 + 100;
+    QVERIFY( recordFrames( path, frames ) );
+
+    // Cut into the last chunk: everything before it still plays, then the replay stops cleanly.
+    QVERIFY( QFile::resize( path, QFileInfo( path ).size() - 10 ) );
+
+    InputReplay replay;
+    QVERIFY( replay.open( path ) );
+
+    quint64 played = 0;
+
+    while( replay.nextFrame() ) {
+
+        for( int port = 0; port < 2; ++port ) {
+            QVERIFY( sameState( replay.state( port ), recordedState( port, played ) ) );
+        }
+
+        ++played;
+
+    }
+
+    QVERIFY( played > 0 );
+    QVERIFY( played < frames );
+    QCOMPARE( replay.frame(), played );
+    QVERIFY( sameState( replay.state( 0 ), InputState() ) );
+
+    // Stays over.
+    QVERIFY( !replay.nextFrame() );
+
+    // Not even a whole header left.
+    QVERIFY( QFile::resize( path, 4 ) );
+    QVERIFY( !replay.open( path ) );
+    QVERIFY( !replay.isOpen() );
+
+}
+
+void InputBenchmark::qmlInputDeviceInsert() {
+
+    QMLInputDevice device;
+    int state = 0;
+
+    QBENCHMARK {
+        state ^= 1;
+        device.insert( InputDeviceEvent::A, state );
+    }
+
+    // Lets the queued buttonsChanged() go.
+    QCoreApplication::processEvents();
+
+}
+
+void InputBenchmark::qmlInputDeviceInsertBatch() {
+
+    QMLInputDevice device;
+    InputEventList presses;
+    InputEventList releases;
+
+    for( int i = 0; i < InputDeviceEvent::Unknown; ++i ) {
+
+        InputEvent event;
+        event.device = 0;
+        event.event = static_cast<qint16>( i );
+        event.value = 1;
+        event.timestamp = 0;
+
+        presses.append( event );
+
+        event.value = 0;
+        releases.append( event );
+
+    }
+
+    bool pressed = false;
+
+    QBENCHMARK {
+        pressed = !pressed;
+        device.insertBatch( pressed ? presses : releases );
+    }
+
+}
+
+void InputBenchmark::qmlInputDeviceHeldByAnyDevice() {
+
+    QMLInputDevice device;
+
+    auto edge = []( qint16 pad, int16_t value ) {
+        InputEvent event;
+        event.device = pad;
+        event.event = InputDeviceEvent::A;
+        event.value = value;
+        event.timestamp = 0;
+        return InputEventList() << event;
+    };
+
+    device.insertBatch( edge( 0, 1 ) );
+    device.insertBatch( edge( 1, 1 ) );
+
+    // The second pad still holds it.
+    device.insertBatch( edge( 0, 0 ) );
+    QVERIFY( device.a() );
+
+    // Unplugged while holding it.
+    device.releaseDevice( 1 );
+    QVERIFY( !device.a() );
+
+}
+
+void InputBenchmark::inputDeviceEventToEvent() {
+
+    const QString names[] = { "a", "b", "x", "y", "dpup", "leftx", "righttrigger", "guide" };
+    int sum = 0;
+
+    QBENCHMARK {
+        for( const QString &name : names ) {
+            sum += InputDeviceEvent::toEvent( name );
+        }
+    }
+
+    Q_UNUSED( sum );
+
+}
+
+void InputBenchmark::inputDeviceEventToString() {
+
+    int length = 0;
+
+    QBENCHMARK {
+        for( int i = 0; i < InputDeviceEvent::Unknown; ++i ) {
+            length += InputDeviceEvent::toString( static_cast<InputDeviceEvent::Event>( i ) ).size();
+        }
+    }
+
+    Q_UNUSED( length );
+
+}
+
+void InputBenchmark::inputDeviceEventMatchesSDL() {
+
+    // Every button up to the D-pad has a RETRO_PAD equivalent, the later ones (misc, paddles, touchpad) don't.
+    for( int i = 0; i <= SDL_CONTROLLER_BUTTON_DPAD_RIGHT; ++i ) {
+        auto button = static_cast<SDL_GameControllerButton>( i );
+        QLatin1String name( SDL_GameControllerGetStringForButton( button ) );
+
+        InputDeviceEvent::Event event = InputDeviceEvent::toEvent( name );
+
+        QVERIFY2( event != InputDeviceEvent::Unknown, name.data() );
+        QCOMPARE( InputDeviceEvent::toString( event ), name );
+    }
+
+    for( int i = SDL_CONTROLLER_BUTTON_DPAD_RIGHT + 1; i < SDL_CONTROLLER_BUTTON_MAX; ++i ) {
+        auto button = static_cast<SDL_GameControllerButton>( i );
+        QLatin1String name( SDL_GameControllerGetStringForButton( button ) );
+
+        QCOMPARE( InputDeviceEvent::toEvent( name ), InputDeviceEvent::Unknown );
+    }
+
+    QCOMPARE( InputDeviceEvent::toString( InputDeviceEvent::L2 ),
+              QLatin1String( SDL_GameControllerGetStringForAxis( SDL_CONTROLLER_AXIS_TRIGGERLEFT ) ) );
+    QCOMPARE( InputDeviceEvent::toString( InputDeviceEvent::R2 ),
+              QLatin1String( SDL_GameControllerGetStringForAxis( SDL_CONTROLLER_AXIS_TRIGGERRIGHT ) ) );
+
+    // The sticks are axes, not events.
+    for( int i = SDL_CONTROLLER_AXIS_LEFTX; i <= SDL_CONTROLLER_AXIS_RIGHTY; ++i ) {
+        auto axis = static_cast<SDL_GameControllerAxis>( i );
+        QCOMPARE( InputDeviceEvent::toEvent( QLatin1String( SDL_GameControllerGetStringForAxis( axis ) ) ),
+                  InputDeviceEvent::Unknown );
+    }
+
+}
+
+void InputBenchmark::inputDeviceEventLegacyNames() {
+    QCOMPARE( InputDeviceEvent::toEvent( QString( "select" ) ), InputDeviceEvent::Select );
+    QCOMPARE( InputDeviceEvent::toEvent( QString( "dup" ) ), InputDeviceEvent::Up );
+    QCOMPARE( InputDeviceEvent::toString( InputDeviceEvent::Select ), QLatin1String( "back" ) );
+    QCOMPARE( InputDeviceEvent::toString( InputDeviceEvent::Up ), QLatin1String( "dpup" ) );
+    QCOMPARE( InputDeviceEvent::toEvent( QString() ), InputDeviceEvent::Unknown );
+}
+
+void InputBenchmark::inputLayoutTranslate_data() {
+
+    QTest::addColumn<int>( "layout" );
+    QTest::addColumn<quint32>( "sdlButtons" );
+    QTest::addColumn<int>( "trigger" );
+    QTest::addColumn<quint32>( "buttons" );
+    QTest::addColumn<int>( "leftTrigger" );
+
+    auto sdl = []( const SDL_GameControllerButton button ) {
+        return 1u << button;
+    };
+
+    auto retro = []( const InputDeviceEvent::Event event ) {
+        return InputState::mask( event );
+    };
+
+    const quint32 face = sdl( SDL_CONTROLLER_BUTTON_A ) | sdl( SDL_CONTROLLER_BUTTON_B );
+    const quint32 shoulders = sdl( SDL_CONTROLLER_BUTTON_LEFTSHOULDER ) | sdl( SDL_CONTROLLER_BUTTON_Y );
+    const quint32 menu = sdl( SDL_CONTROLLER_BUTTON_BACK ) | sdl( SDL_CONTROLLER_BUTTON_GUIDE )
+                         | sdl( SDL_CONTROLLER_BUTTON_DPAD_UP );
+
+    QTest::newRow( "SNES face" ) << int( InputLayout::SNES ) << face << 0
+                                 << ( retro( InputDeviceEvent::B ) | retro( InputDeviceEvent::A ) ) << 0;
+    QTest::newRow( "SNES top" ) << int( InputLayout::SNES ) << shoulders << 0
+                                << ( retro( InputDeviceEvent::L ) | retro( InputDeviceEvent::X ) ) << 0;
+    QTest::newRow( "SNES menu" ) << int( InputLayout::SNES ) << menu << 0
+                                 << ( retro( InputDeviceEvent::Select ) | retro( InputDeviceEvent::Guide )
+                                      | retro( InputDeviceEvent::Up ) ) << 0;
+    QTest::newRow( "SNES trigger" ) << int( InputLayout::SNES ) << 0u << 20000
+                                    << retro( InputDeviceEvent::L2 ) << 20000;
+
+    QTest::newRow( "Genesis face" ) << int( InputLayout::Genesis ) << ( face | sdl( SDL_CONTROLLER_BUTTON_X ) ) << 0
+                                    << ( retro( InputDeviceEvent::B ) | retro( InputDeviceEvent::A )
+                                         | retro( InputDeviceEvent::Y ) ) << 0;
+    QTest::newRow( "Genesis top" ) << int( InputLayout::Genesis ) << shoulders << 0
+                                   << ( retro( InputDeviceEvent::L ) | retro( InputDeviceEvent::X ) ) << 0;
+    QTest::newRow( "Genesis trigger" ) << int( InputLayout::Genesis ) << 0u << 20000
+                                       << retro( InputDeviceEvent::L2 ) << 20000;
+
+    // Xbox B and Y have no N64 equivalent, and neither does Back.
+    QTest::newRow( "N64 face" ) << int( InputLayout::N64 ) << ( face | sdl( SDL_CONTROLLER_BUTTON_X ) ) << 0
+                                << ( retro( InputDeviceEvent::B ) | retro( InputDeviceEvent::Y ) ) << 0;
+    QTest::newRow( "N64 top" ) << int( InputLayout::N64 ) << shoulders << 0
+                               << retro( InputDeviceEvent::L ) << 0;
+    QTest::newRow( "N64 menu" ) << int( InputLayout::N64 ) << menu << 0
+                                << ( retro( InputDeviceEvent::Guide ) | retro( InputDeviceEvent::Up ) ) << 0;
+    QTest::newRow( "N64 trigger" ) << int( InputLayout::N64 ) << 0u << 20000
+                                   << retro( InputDeviceEvent::L2 ) << 20000;
+
+    QTest::newRow( "PlayStation face" ) << int( InputLayout::PlayStation )
+                                        << ( face | sdl( SDL_CONTROLLER_BUTTON_X ) ) << 0
+                                        << ( retro( InputDeviceEvent::B ) | retro( InputDeviceEvent::A )
+                                             | retro( InputDeviceEvent::Y ) ) << 0;
+    QTest::newRow( "PlayStation top" ) << int( InputLayout::PlayStation ) << shoulders << 0
+                                       << ( retro( InputDeviceEvent::L ) | retro( InputDeviceEvent::X ) ) << 0;
+
+    // L2 is pressed, but there's no analog trigger to report.
+    QTest::newRow( "PlayStation trigger" ) << int( InputLayout::PlayStation ) << 0u << 20000
+                                           << retro( InputDeviceEvent::L2 ) << 0;
+
+}
+
+void InputBenchmark::inputLayoutTranslate() {
+
+    QFETCH( int, layout );
+    QFETCH( quint32, sdlButtons );
+    QFETCH( int, trigger );
+    QFETCH( quint32, buttons );
+    QFETCH( int, leftTrigger );
+
+    JoystickState pad;
+    pad.buttons = sdlButtons;
+    pad.axes[ SDL_CONTROLLER_AXIS_LEFTX ] = -1234;
+    pad.axes[ SDL_CONTROLLER_AXIS_TRIGGERLEFT ] = static_cast<qint16>( trigger );
+
+    InputState state = InputLayout::translate( static_cast<InputLayout::Type>( layout ), pad );
+
+    QCOMPARE( state.buttons, buttons );
+    QCOMPARE( static_cast<int>( state.axes[ InputState::LeftTrigger ] ), leftTrigger );
+
+    // Every layout keeps the sticks.
+    QCOMPARE( static_cast<int>( state.axes[ InputState::LeftX ] ), -1234 );
+
+}
+
+void InputBenchmark::joystickLoadSDLMapping() {
+
+    if( !VirtualJoystick::isSupported() ) {
+        QSKIP( "Needs virtual joystick support" );
+    }
+
+    VirtualPads pads;
+    QVERIFY( pads.attach( 1 ) );
+
+    Joystick *joystick = pads.joysticks.first();
+
+    // Resetting the mapping reloads it from SDL.
+    QBENCHMARK {
+        joystick->setResetMapping( true );
+    }
+
+}
+
+void InputBenchmark::pollTick_data() {
+
+    QTest::addColumn<int>( "devices" );
+
+    QTest::newRow( "1 device" ) << 1;
+    QTest::newRow( "4 devices" ) << 4;
+    QTest::newRow( "16 devices" ) << 16;
+    QTest::newRow( "128 devices" ) << 128;
+
+}
+
+void InputBenchmark::pollTick() {
+
+    if( !VirtualJoystick::isSupported() ) {
+        QSKIP( "Needs virtual joystick support" );
+    }
+
+    QFETCH( int, devices );
+
+    VirtualPads pads;
+    QVERIFY( pads.attach( devices ) );
+
+    InputEventList events;
+    events.reserve( InputEventQueue::capacity );
+    bool pressed = false;
+
+    QBENCHMARK {
+        pressed = !pressed;
+        pads.toggleButton( pressed );
+        pads.eventLoop->pollEvents();
+
+        // Stand in for the GUI thread, so the queue never fills up.
+        pads.frontendQueue.drain( events );
+        events.resize( 0 );
+    }
+
+}
+
+void InputBenchmark::pollTickDoesNotAllocate() {
+
+#if !defined( BENCHMARK_COUNTS_ALLOCATIONS )
+    QSKIP( "Allocations can only be counted with glibc" );
+#else
+
+    if( !VirtualJoystick::isSupported() ) {
+        QSKIP( "Needs virtual joystick support" );
+    }
+
+    VirtualPads pads;
+    QVERIFY( pads.attach( 4 ) );
+
+    InputEventList events;
+    events.reserve( InputEventQueue::capacity );
+
+    // Let SDL and Qt warm up whatever they cache on the first few ticks.
+    for( int i = 0; i < 16; ++i ) {
+        pads.toggleButton( i % 2 );
+        pads.eventLoop->pollEvents();
+        pads.frontendQueue.drain( events );
+        events.resize( 0 );
+    }
+
+    quint64 before = allocationCount.load();
+
+    for( int i = 0; i < 1000; ++i ) {
+        pads.toggleButton( i % 2 );
+        pads.eventLoop->pollEvents();
+        pads.frontendQueue.drain( events );
+        events.resize( 0 );
+    }
+
+    QCOMPARE( allocationCount.load() - before, quint64( 0 ) );
+
+#endif
+
+}
+
+void InputBenchmark::hotplugSoak() {
+
+    if( !VirtualJoystick::isSupported() ) {
+        QSKIP( "Needs virtual joystick support" );
+    }
+
+    int seconds = qMax( 1, qEnvironmentVariableIsSet( "BENCHMARK_SOAK_SECONDS" )
+                        ? qgetenv( "BENCHMARK_SOAK_SECONDS" ).toInt() : 10 );
+
+    InputManager manager;
+
+    // One round first, so whatever SDL and Qt allocate once doesn't count as growth.
+    manager.attachVirtualJoysticks( 16 );
+    QTest::qWait( 100 );
+    manager.detachVirtualJoysticks( 16 );
+    QTest::qWait( 100 );
+
+    qint64 memoryBefore = residentBytes();
+    manager.resetPollTickStats();
+
+    bool consistent = true;
+    quint64 plugged = 0;
+    int round = 0;
+
+    QElapsedTimer timer;
+    timer.start();
+
+    while( timer.elapsed() < seconds * 1000 ) {
+
+        // Anywhere from 1 to 16 pads at once, some removed while they're still being opened.
+        int pads = 1 + round % 16;
+
+        manager.attachVirtualJoysticks( pads );
+        QTest::qWait( 5 + round % 20 );
+
+        consistent &= manager.verifyConsistency();
+
+        manager.detachVirtualJoysticks( pads );
+        QTest::qWait( 5 + round % 20 );
+
+        plugged += pads;
+        ++round;
+
+    }
+
+    // Let the last removals reach the InputManager.
+    QTest::qWait( 200 );
+    consistent &= manager.verifyConsistency();
+
+    qint64 memoryGrowth = memoryBefore < 0 ? 0 : residentBytes() - memoryBefore;
+    qint64 maxTick = manager.maxPollTickDuration();
+
+    qDebug() << plugged * 60000 / timer.elapsed() << "pads plugged in per minute,"
+             << "memory grew by" << memoryGrowth / 1024 << "KiB,"
+             << "longest poll tick" << maxTick / 1000 << "us";
+
+    QTest::setBenchmarkResult( maxTick / 1000000.0, QTest::WalltimeMilliseconds );
+
+    QVERIFY2( consistent, "The device bookkeeping went out of sync, see the warnings above" );
+
+    // Generous, allocator caching alone accounts for some growth.
+    QVERIFY2( memoryGrowth < 16 * 1024 * 1024, "Memory grew by more than 16 MiB" );
+
+}
+
+QTEST_GUILESS_MAIN( InputBenchmark )
+
+#include "inputbenchmark.moc"
@@ -1,5 +1,6 @@
 TEMPLATE = subdirs
 
-SUBDIRS += backend frontend
+SUBDIRS += backend frontend benchmarks
 
 frontend.depends = backend
+benchmarks.depends = backend
@@ -0,0 +1,469 @@
+#include "controllerdb.h"
+
+#include "logging.h"
+
+#include <QDir>
+#include <QHash>
+#include <QList>
+#include <QResource>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <QVector>
+
+#include <cstring>
+
+namespace {
+
+    const char dbMagic[ 8 ] = { 'P', 'H', 'X', 'C', 'D', 'B', '0', '1' };
+
+    // Starts every ControllerMapping profile. Bump the version whenever ControllerMapping changes.
+    const char profileMagic[ 8 ] = { 'P', 'H', 'X', 'M', 'A', 'P', '0', '1' };
+
+    // All offsets are from the start of the file.
+    struct ControllerDBHeader {
+        char magic[ 8 ];
+        quint32 sourceHash;
+        quint32 buttonMax;
+        quint32 axisMax;
+        quint32 entryCount;
+
+        // Open addressed hash table of ( entry index + 1 ), 0 means empty. Always a power of two.
+        quint32 tableSize;
+        quint32 tableOffset;
+
+        quint32 entriesOffset;
+        quint32 stringsOffset;
+        quint32 stringsSize;
+    };
+
+    quint32 fnv1a( const uchar *data, const qint64 size ) {
+
+        quint32 hash = 2166136261u;
+
+        for( qint64 i = 0; i < size; ++i ) {
+            hash ^= data[ i ];
+            hash *= 16777619u;
+        }
+
+        return hash;
+
+    }
+
+    quint32 align( const quint32 offset ) {
+        return ( offset + 7 ) & ~7u;
+    }
+
+    int hexValue( const char c ) {
+
+        if( c >= '0' && c <= '9' ) {
+            return c - '0';
+        }
+
+        if( c >= 'a' && c <= 'f' ) {
+            return c - 'a' + 10;
+        }
+
+        if( c >= 'A' && c <= 'F' ) {
+            return c - 'A' + 10;
+        }
+
+        return -1;
+
+    }
+
+    bool parseGUID( const QByteArray &string, quint8 *guid ) {
+
+        if( string.size() != 32 ) {
+            return false;
+        }
+
+        for( int i = 0; i < 16; ++i ) {
+
+            int high = hexValue( string.at( i * 2 ) );
+            int low = hexValue( string.at( i * 2 + 1 ) );
+
+            if( high < 0 || low < 0 ) {
+                return false;
+            }
+
+            guid[ i ] = static_cast<quint8>( ( high << 4 ) | low );
+
+        }
+
+        return true;
+
+    }
+
+}
+
+void ControllerMapping::clear() {
+
+    for( int i = 0; i < maxButtons; ++i ) {
+        buttons[ i ] = -1;
+        hats[ i ] = -1;
+    }
+
+    for( int i = 0; i < maxAxes; ++i ) {
+        axes[ i ] = -1;
+    }
+
+    buttonAxisMask = 0;
+
+}
+
+QByteArray ControllerMapping::toProfile() const {
+
+    QByteArray profile( profileMagic, sizeof( profileMagic ) );
+    profile.append( reinterpret_cast<const char *>( this ), sizeof( ControllerMapping ) );
+    return profile;
+
+}
+
+bool ControllerMapping::fromProfile( const QByteArray &profile ) {
+
+    if( profile.size() != static_cast<int>( sizeof( profileMagic ) + sizeof( ControllerMapping ) )
+        || std::memcmp( profile.constData(), profileMagic, sizeof( profileMagic ) ) != 0 ) {
+        return false;
+    }
+
+    std::memcpy( this, profile.constData() + sizeof( profileMagic ), sizeof( ControllerMapping ) );
+    return true;
+
+}
+
+ControllerDB::ControllerDB()
+    : data( nullptr ),
+      dataSize( 0 ) {
+
+    // Ensures the resources at loaded at startup, even during
+    // static compilation.
+    Q_INIT_RESOURCE( controllerdb );
+
+    // Hashing the compiled in resource is much cheaper than parsing it.
+    QResource resource( ":/input/gamecontrollerdb.txt" );
+    quint32 sourceHash = fnv1a( resource.data(), resource.size() );
+
+    QString cacheDir = QStandardPaths::writableLocation( QStandardPaths::CacheLocation );
+    QString cachePath = cacheDir + QStringLiteral( "/gamecontrollerdb.bin" );
+
+    if( open( cachePath, sourceHash ) ) {
+        return;
+    }
+
+    QFile sourceFile( ":/input/gamecontrollerdb.txt" );
+
+    if( !sourceFile.open( QIODevice::ReadOnly ) ) {
+        qCWarning( phxInput ) << "Unable to open" << sourceFile.fileName();
+        return;
+    }
+
+    QByteArray index = build( sourceFile.readAll(), sourceHash );
+
+    QDir().mkpath( cacheDir );
+    QSaveFile saveFile( cachePath );
+
+    if( saveFile.open( QIODevice::WriteOnly ) && saveFile.write( index ) == index.size() && saveFile.commit()
+        && open( cachePath, sourceHash ) ) {
+        qCDebug( phxInput ) << "Compiled the controller database into" << cachePath;
+        return;
+    }
+
+    qCWarning( phxInput ) << "Unable to write" << cachePath << ", keeping the controller database in memory";
+
+    buffer = index;
+    data = reinterpret_cast<const uchar *>( buffer.constData() );
+    dataSize = buffer.size();
+
+}
+
+ControllerDB::~ControllerDB() {
+    cacheFile.close();
+}
+
+const ControllerDB &ControllerDB::instance() {
+    static ControllerDB controllerDB;
+    return controllerDB;
+}
+
+const ControllerDBEntry *ControllerDB::find( const SDL_JoystickGUID &guid ) const {
+
+    if( !data ) {
+        return nullptr;
+    }
+
+    auto *header = reinterpret_cast<const ControllerDBHeader *>( data );
+    auto *table = reinterpret_cast<const quint32 *>( data + header->tableOffset );
+    auto *entries = reinterpret_cast<const ControllerDBEntry *>( data + header->entriesOffset );
+    quint32 mask = header->tableSize - 1;
+
+    quint32 slot = fnv1a( guid.data, sizeof( guid.data ) ) & mask;
+
+    // The table written by the builder is never more than half full, but a damaged cache may have no empty slot,
+    // so give up after one lap.
+    for( quint32 probes = 0; probes < header->tableSize && table[ slot ] != 0; ++probes, slot = ( slot + 1 ) & mask ) {
+
+        quint32 index = table[ slot ] - 1;
+
+        if( index >= header->entryCount ) {
+            break;
+        }
+
+        auto *entry = &entries[ index ];
+
+        if( std::memcmp( entry->guid, guid.data, sizeof( entry->guid ) ) == 0 ) {
+            return entry;
+        }
+
+    }
+
+    return nullptr;
+
+}
+
+const char *ControllerDB::mappingString( const ControllerDBEntry *entry ) const {
+
+    auto *header = reinterpret_cast<const ControllerDBHeader *>( data );
+
+    if( entry->mappingOffset >= header->stringsSize ) {
+        return nullptr;
+    }
+
+    return reinterpret_cast<const char *>( data + header->stringsOffset + entry->mappingOffset );
+
+}
+
+int ControllerDB::size() const {
+
+    if( !data ) {
+        return 0;
+    }
+
+    return reinterpret_cast<const ControllerDBHeader *>( data )->entryCount;
+
+}
+
+bool ControllerDB::parseMapping( const QByteArray &line, ControllerMapping &mapping ) {
+
+    mapping.clear();
+
+    auto fields = line.split( ',' );
+
+    // The first two fields are the GUID and the name.
+    for( int i = 2; i < fields.size(); ++i ) {
+
+        const QByteArray &field = fields.at( i );
+        int colon = field.indexOf( ':' );
+
+        if( colon <= 0 ) {
+            continue;
+        }
+
+        QByteArray key = field.left( colon ).trimmed();
+        QByteArray value = field.mid( colon + 1 ).trimmed();
+
+        if( key == "platform" ) {
+
+            if( value != SDL_GetPlatform() ) {
+                return false;
+            }
+
+            continue;
+
+        }
+
+        // Unmapped buttons, like "guide:", are allowed.
+        if( value.isEmpty() ) {
+            continue;
+        }
+
+        // Newer databases can mark half axes and inverted axes, the raw index is all we want.
+        if( value.startsWith( '+' ) || value.startsWith( '-' ) ) {
+            value.remove( 0, 1 );
+        }
+
+        if( value.endsWith( '~' ) ) {
+            value.chop( 1 );
+        }
+
+        if( value.isEmpty() ) {
+            continue;
+        }
+
+        char prefix = value.at( 0 );
+        QByteArray number = value.mid( 1 );
+
+        auto axis = SDL_GameControllerGetAxisFromString( key.constData() );
+
+        if( axis != SDL_CONTROLLER_AXIS_INVALID ) {
+
+            mapping.axes[ axis ] = static_cast<qint16>( number.toInt() );
+
+            if( prefix == 'b' ) {
+                mapping.buttonAxisMask |= 1u << axis;
+            }
+
+            continue;
+
+        }
+
+        auto button = SDL_GameControllerGetButtonFromString( key.constData() );
+
+        if( button == SDL_CONTROLLER_BUTTON_INVALID ) {
+            continue;
+        }
+
+        switch( prefix ) {
+
+            case 'b':
+                mapping.buttons[ button ] = static_cast<qint16>( number.toInt() );
+                break;
+
+            // Hats look like "h0.4", the hat index followed by the direction mask.
+            case 'h': {
+                int dot = number.indexOf( '.' );
+                mapping.hats[ button ] = static_cast<qint16>( ( number.left( dot ).toInt() << 8 )
+                                                              | number.mid( dot + 1 ).toInt() );
+                break;
+            }
+
+            default:
+                qCWarning( phxInput ) << key
+                                      << " has an unhandled axis value. Report this to the Phoenix "
+                                      << " developers.";
+                break;
+
+        }
+
+    }
+
+    return true;
+
+}
+
+bool ControllerDB::open( const QString &path, const quint32 sourceHash ) {
+
+    cacheFile.setFileName( path );
+
+    if( !cacheFile.open( QIODevice::ReadOnly ) ) {
+        return false;
+    }
+
+    qint64 size = cacheFile.size();
+    const uchar *map = size >= static_cast<qint64>( sizeof( ControllerDBHeader ) ) ? cacheFile.map( 0, size ) : nullptr;
+
+    if( map ) {
+
+        auto *header = reinterpret_cast<const ControllerDBHeader *>( map );
+        quint64 tableEnd = header->tableOffset + static_cast<quint64>( header->tableSize ) * sizeof( quint32 );
+        quint64 entriesEnd = header->entriesOffset + static_cast<quint64>( header->entryCount ) * sizeof( ControllerDBEntry );
+
+        bool valid = std::memcmp( header->magic, dbMagic, sizeof( dbMagic ) ) == 0
+                     && header->sourceHash == sourceHash
+                     && header->buttonMax == static_cast<quint32>( ControllerMapping::maxButtons )
+                     && header->axisMax == static_cast<quint32>( ControllerMapping::maxAxes )
+                     && header->tableSize != 0 && ( header->tableSize & ( header->tableSize - 1 ) ) == 0
+                     && tableEnd <= static_cast<quint64>( size )
+                     && entriesEnd <= static_cast<quint64>( size )
+                     && header->stringsOffset + static_cast<quint64>( header->stringsSize ) <= static_cast<quint64>( size )
+                     // So mappingString() never runs off the end of the strings
+                     && ( header->stringsSize == 0 || map[ header->stringsOffset + header->stringsSize - 1 ] == '\0' );
+
+        if( valid ) {
+            data = map;
+            dataSize = size;
+            return true;
+        }
+
+    }
+
+    // Stale or damaged, it'll be rebuilt.
+    cacheFile.close();
+    return false;
+
+}
+
+QByteArray ControllerDB::build( const QByteArray &source, const quint32 sourceHash ) {
+
+    QVector<ControllerDBEntry> entries;
+    QHash<QByteArray, int> entryIndex;
+    QByteArray strings;
+
+    for( QByteArray line : source.split( '\n' ) ) {
+
+        line = line.trimmed();
+
+        if( line.isEmpty() || line.startsWith( '#' ) ) {
+            continue;
+        }
+
+        ControllerDBEntry entry;
+        std::memset( &entry, 0, sizeof( entry ) );
+
+        QByteArray guid = line.left( line.indexOf( ',' ) );
+
+        if( !parseGUID( guid, entry.guid ) || !ControllerDB::parseMapping( line, entry.mapping ) ) {
+            continue;
+        }
+
+        entry.mappingOffset = static_cast<quint32>( strings.size() );
+        strings.append( line );
+        strings.append( '\0' );
+
+        // Later lines override earlier ones, just like they do in SDL.
+        int index = entryIndex.value( guid, -1 );
+
+        if( index == -1 ) {
+            entryIndex.insert( guid, entries.size() );
+            entries.append( entry );
+        }
+
+        else {
+            entries[ index ] = entry;
+        }
+
+    }
+
+    quint32 tableSize = 16;
+
+    while( tableSize < static_cast<quint32>( entries.size() ) * 2 ) {
+        tableSize *= 2;
+    }
+
+    QVector<quint32> table( tableSize, 0 );
+
+    for( int i = 0; i < entries.size(); ++i ) {
+
+        quint32 slot = fnv1a( entries.at( i ).guid, sizeof( entries.at( i ).guid ) ) & ( tableSize - 1 );
+
+        while( table.at( slot ) != 0 ) {
+            slot = ( slot + 1 ) & ( tableSize - 1 );
+        }
+
+        table[ slot ] = static_cast<quint32>( i + 1 );
+
+    }
+
+    ControllerDBHeader header;
+    std::memset( &header, 0, sizeof( header ) );
+    std::memcpy( header.magic, dbMagic, sizeof( dbMagic ) );
+    header.sourceHash = sourceHash;
+    header.buttonMax = ControllerMapping::maxButtons;
+    header.axisMax = ControllerMapping::maxAxes;
+    header.entryCount = static_cast<quint32>( entries.size() );
+    header.tableSize = tableSize;
+    header.tableOffset = align( sizeof( header ) );
+    header.entriesOffset = align( header.tableOffset + tableSize * sizeof( quint32 ) );
+    header.stringsOffset = align( header.entriesOffset + entries.size() * sizeof( ControllerDBEntry ) );
+    header.stringsSize = static_cast<quint32>( strings.size() );
+
+    QByteArray index( header.stringsOffset + header.stringsSize, '\0' );
+    char *out = index.data();
+
+    std::memcpy( out, &header, sizeof( header ) );
+    std::memcpy( out + header.tableOffset, table.constData(), tableSize * sizeof( quint32 ) );
+    std::memcpy( out + header.entriesOffset, entries.constData(), entries.size() * sizeof( ControllerDBEntry ) );
+    std::memcpy( out + header.stringsOffset, strings.constData(), strings.size() );
+
+    return index;
+
+}
@@ -0,0 +1,142 @@
+#ifndef CONTROLLERDB_H
+#define CONTROLLERDB_H
+
+#include <QByteArray>
+#include <QFile>
+#include <QString>
+
+#include "SDL.h"
+#include "SDL_gamecontroller.h"
+
+#include "joystickstate.h"
+
+// ControllerMapping is an SDL GameController mapping with every binding already resolved: for each SDL button
+// and axis, which raw joystick button, hat or axis it reads from.
+struct ControllerMapping {
+
+    static const int maxButtons = 32;
+    static const int maxAxes = 8;
+
+    // Raw joystick button index, -1 if unmapped
+    qint16 buttons[ maxButtons ];
+
+    // Buttons mapped to a hat direction, stored as ( hat << 8 ) | direction mask, -1 if unmapped
+    qint16 hats[ maxButtons ];
+
+    // Raw joystick axis index, -1 if unmapped
+    qint16 axes[ maxAxes ];
+
+    // Bit n is set when SDL_GameControllerAxis n is mapped to a raw button instead of an axis
+    quint32 buttonAxisMask;
+
+    void clear();
+
+    // Decodes every SDL button and axis from the raw state of 'device', which needs
+    //     quint8 button( int index ) const, quint8 hat( int index ) const and qint16 axis( int index ) const,
+    // each returning 0 for an index it doesn't have. 'digitalTriggers' reads both triggers from raw buttons, as if
+    // their bits in buttonAxisMask were set.
+    template<typename RawDevice>
+    JoystickState read( const RawDevice &device, const bool digitalTriggers = false ) const {
+
+        JoystickState state;
+
+        for( int button = 0; button < SDL_CONTROLLER_BUTTON_MAX; ++button ) {
+
+            bool pressed;
+
+            if( hats[ button ] >= 0 ) {
+                pressed = ( device.hat( hats[ button ] >> 8 ) & ( hats[ button ] & 0xFF ) ) != 0;
+            } else {
+                pressed = buttons[ button ] >= 0 && device.button( buttons[ button ] ) != 0;
+            }
+
+            state.buttons |= static_cast<quint32>( pressed ) << button;
+
+        }
+
+        quint32 buttonAxes = buttonAxisMask;
+
+        if( digitalTriggers ) {
+            buttonAxes |= ( 1u << SDL_CONTROLLER_AXIS_TRIGGERLEFT ) | ( 1u << SDL_CONTROLLER_AXIS_TRIGGERRIGHT );
+        }
+
+        for( int axis = 0; axis < SDL_CONTROLLER_AXIS_MAX; ++axis ) {
+
+            if( axes[ axis ] < 0 ) {
+                continue;
+            }
+
+            state.axes[ axis ] = ( buttonAxes & ( 1u << axis ) ) ? device.button( axes[ axis ] ) : device.axis( axes[ axis ] );
+
+        }
+
+        return state;
+
+    }
+
+    // The mapping as saved in the ProfileStore, tagged with a magic and version.
+    QByteArray toProfile() const;
+
+    // Returns false, and leaves the mapping alone, if 'profile' wasn't saved by this version's toProfile().
+    bool fromProfile( const QByteArray &profile );
+
+};
+
+static_assert( SDL_CONTROLLER_BUTTON_MAX <= ControllerMapping::maxButtons, "ControllerMapping is too small" );
+static_assert( SDL_CONTROLLER_AXIS_MAX <= ControllerMapping::maxAxes, "ControllerMapping is too small" );
+
+struct ControllerDBEntry {
+    quint8 guid[ 16 ];
+    ControllerMapping mapping;
+
+    // Offset of the original mapping line inside of the string table
+    quint32 mappingOffset;
+};
+
+// ControllerDB is a binary index of gamecontrollerdb.txt, keyed by joystick GUID.
+
+// The first run parses the text file once and writes the index to the cache directory. Every run after that
+// memory maps the index, so startup never parses the text again, and a Joystick resolves its whole mapping
+// with one hash lookup. The index is rebuilt whenever the bundled gamecontrollerdb.txt changes.
+
+// Only entries for the current platform are kept, the same way SDL filters them.
+
+class ControllerDB {
+
+    public:
+
+        static const ControllerDB &instance();
+
+        // nullptr if the GUID is not in the database
+        const ControllerDBEntry *find( const SDL_JoystickGUID &guid ) const;
+
+        // The SDL mapping line the entry was built from, for SDL_GameControllerAddMapping(). nullptr if the
+        // index is damaged.
+        const char *mappingString( const ControllerDBEntry *entry ) const;
+
+        int size() const;
+
+        // Resolves an SDL mapping string ("guid,name,a:b0,dpup:h0.1,...") into 'mapping'. Returns false if
+        // the line isn't meant for this platform.
+        static bool parseMapping( const QByteArray &line, ControllerMapping &mapping );
+
+    private:
+
+        ControllerDB();
+        ~ControllerDB();
+        Q_DISABLE_COPY( ControllerDB )
+
+        QFile cacheFile;
+
+        // Used instead of the mapped file if the cache can't be written
+        QByteArray buffer;
+
+        const uchar *data;
+        qint64 dataSize;
+
+        bool open( const QString &path, const quint32 sourceHash );
+        static QByteArray build( const QByteArray &source, const quint32 sourceHash );
+
+};
+
+#endif // CONTROLLERDB_H
@@ -0,0 +1,345 @@
+#include "evdeveventloop.h"
+
+#ifdef Q_OS_LINUX
+
+#include "joystick.h"
+#include "keyboard.h"
+#include "logging.h"
+
+#include <QDir>
+
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+EvdevEventLoop::EvdevEventLoop( QObject *parent )
+    : QObject( parent ),
+      epollFD( epoll_create1( EPOLL_CLOEXEC ) ),
+      inotifyFD( inotify_init1( IN_NONBLOCK | IN_CLOEXEC ) ),
+      wakeFD( eventfd( 0, EFD_NONBLOCK | EFD_CLOEXEC ) ),
+      deviceThread( QThread::currentThread() ),
+      devices( Joystick::maxNumOfDevices, nullptr ),
+      joysticksEnabled( true ),
+      keyboard( nullptr ),
+      keyboardFocus( true ),
+      frontendQueue( nullptr ),
+      editModeQueue( nullptr ) {
+
+    if( epollFD < 0 || wakeFD < 0 ) {
+        qCWarning( phxInput ) << "Unable to set up epoll:" << strerror( errno );
+        return;
+    }
+
+    // The pointers tell run() what woke it up.
+    epoll_event event;
+    event.events = EPOLLIN;
+    event.data.ptr = &wakeFD;
+    epoll_ctl( epollFD, EPOLL_CTL_ADD, wakeFD, &event );
+
+    // udev creates the node first and fixes its permissions afterwards, so watch for both.
+    if( inotifyFD >= 0 && inotify_add_watch( inotifyFD, "/dev/input", IN_CREATE | IN_ATTRIB ) >= 0 ) {
+        event.data.ptr = &inotifyFD;
+        epoll_ctl( epollFD, EPOLL_CTL_ADD, inotifyFD, &event );
+    }
+
+    else {
+        qCWarning( phxInput ) << "Unable to watch /dev/input, controllers won't be hotplugged:" << strerror( errno );
+    }
+
+}
+
+EvdevEventLoop::~EvdevEventLoop() {
+
+    // The joysticks themselves belong to the InputManager.
+    qDeleteAll( keyboards );
+
+    for( int fd : { epollFD, inotifyFD, wakeFD } ) {
+        if( fd >= 0 ) {
+            ::close( fd );
+        }
+    }
+
+}
+
+void EvdevEventLoop::setEventQueues( InputEventQueue *frontend, InputEventQueue *editMode ) {
+    frontendQueue = frontend;
+    editModeQueue = editMode;
+}
+
+void EvdevEventLoop::setJoysticksEnabled( const bool enabled ) {
+    joysticksEnabled = enabled;
+}
+
+void EvdevEventLoop::setKeyboard( Keyboard *keyboard ) {
+    this->keyboard = keyboard;
+}
+
+void EvdevEventLoop::setKeyboardFocus( const bool focus ) {
+    keyboardFocus.store( focus, std::memory_order_relaxed );
+}
+
+void EvdevEventLoop::stop() {
+    quint64 one = 1;
+    ssize_t written = ::write( wakeFD, &one, sizeof( one ) );
+    Q_UNUSED( written );
+}
+
+void EvdevEventLoop::run() {
+
+    if( epollFD < 0 ) {
+        return;
+    }
+
+    scan();
+
+    epoll_event events[ 16 ];
+
+    forever {
+
+        int count = epoll_wait( epollFD, events, 16, -1 );
+
+        if( count < 0 ) {
+
+            if( errno == EINTR ) {
+                continue;
+            }
+
+            qCWarning( phxInput ) << "epoll_wait() failed:" << strerror( errno );
+            closeKeyboards();
+            return;
+
+        }
+
+        for( int i = 0; i < count; ++i ) {
+
+            void *source = events[ i ].data.ptr;
+
+            if( source == &wakeFD ) {
+                quint64 value;
+                ssize_t bytes = ::read( wakeFD, &value, sizeof( value ) );
+                Q_UNUSED( bytes );
+                closeKeyboards();
+                return;
+            }
+
+            if( source == &inotifyFD ) {
+                readHotplugEvents();
+                continue;
+            }
+
+            // Only a few keyboards at most
+            auto *evdevKeyboard = static_cast<EvdevKeyboard *>( source );
+
+            if( keyboards.contains( evdevKeyboard ) ) {
+
+                if( !evdevKeyboard->readEvents( keyboard, keyboardFocus.load( std::memory_order_relaxed ) )
+                    || ( events[ i ].events & ( EPOLLHUP | EPOLLERR ) ) ) {
+                    closeKeyboard( evdevKeyboard );
+                }
+
+                continue;
+
+            }
+
+            auto *joystick = static_cast<EvdevJoystick *>( source );
+
+            if( !joystick->readEvents() || ( events[ i ].events & ( EPOLLHUP | EPOLLERR ) ) ) {
+                closeDevice( joystick );
+            }
+
+        }
+
+        emit polled();
+
+    }
+
+}
+
+//
+// Private
+//
+
+void EvdevEventLoop::scan() {
+
+    QDir directory( "/dev/input" );
+
+    for( const QString &name : directory.entryList( QStringList() << "event*", QDir::System ) ) {
+        openDevice( directory.absoluteFilePath( name ) );
+    }
+
+}
+
+void EvdevEventLoop::openDevice( const QString &path ) {
+
+    if( isOpen( path ) ) {
+        return;
+    }
+
+    int fd = ::open( QFile::encodeName( path ).constData(), O_RDONLY | O_NONBLOCK | O_CLOEXEC );
+
+    // Usually a permission problem, which is normal for anything that's not a controller.
+    if( fd < 0 ) {
+        return;
+    }
+
+    if( openKeyboard( fd, path ) ) {
+        return;
+    }
+
+    if( !joysticksEnabled ) {
+        ::close( fd );
+        return;
+    }
+
+    auto *joystick = new EvdevJoystick( fd, path );
+
+    if( !joystick->isValid() ) {
+        delete joystick;
+        return;
+    }
+
+    joystick->loadMapping();
+
+    int slot = devices.indexOf( nullptr );
+
+    if( slot == -1 ) {
+        qCWarning( phxInput ) << "No free slot for" << path << ", ignored";
+        delete joystick;
+        return;
+    }
+
+    epoll_event event;
+    event.events = EPOLLIN;
+    event.data.ptr = joystick;
+
+    if( epoll_ctl( epollFD, EPOLL_CTL_ADD, fd, &event ) < 0 ) {
+        qCWarning( phxInput ) << "Unable to watch" << path << ":" << strerror( errno );
+        delete joystick;
+        return;
+    }
+
+    joystick->setSlot( slot );
+    joystick->setEventQueues( frontendQueue, editModeQueue );
+    joystick->moveToThread( deviceThread );
+    devices[ slot ] = joystick;
+
+    qCDebug( phxInput ) << "Opened" << joystick->name() << "at" << path << "in slot" << slot;
+
+    emit deviceConnected( joystick );
+
+}
+
+void EvdevEventLoop::closeDevice( EvdevJoystick *joystick ) {
+
+    epoll_ctl( epollFD, EPOLL_CTL_DEL, joystick->fd(), nullptr );
+
+    int slot = devices.indexOf( joystick );
+
+    if( slot == -1 ) {
+        return;
+    }
+
+    devices[ slot ] = nullptr;
+
+    // The InputManager deletes it, don't touch it after this.
+    emit deviceRemoved( slot );
+
+}
+
+bool EvdevEventLoop::openKeyboard( const int fd, const QString &path ) {
+
+    if( !keyboard || !EvdevKeyboard::isKeyboard( fd ) ) {
+        return false;
+    }
+
+    auto *evdevKeyboard = new EvdevKeyboard( fd, path );
+
+    epoll_event event;
+    event.events = EPOLLIN;
+    event.data.ptr = evdevKeyboard;
+
+    // It's a keyboard either way, the fd is taken care of.
+    if( epoll_ctl( epollFD, EPOLL_CTL_ADD, fd, &event ) < 0 ) {
+        qCWarning( phxInput ) << "Unable to watch" << path << ":" << strerror( errno );
+        delete evdevKeyboard;
+        return true;
+    }
+
+    keyboards.append( evdevKeyboard );
+    keyboard->setDirectInput( true );
+
+    qCDebug( phxInput ) << "Reading keyboard input from" << path;
+
+    return true;
+
+}
+
+void EvdevEventLoop::closeKeyboard( EvdevKeyboard *evdevKeyboard ) {
+
+    epoll_ctl( epollFD, EPOLL_CTL_DEL, evdevKeyboard->fd(), nullptr );
+    keyboards.removeOne( evdevKeyboard );
+    delete evdevKeyboard;
+
+    // Nothing's left to read keys from, let the window's key events through again.
+    if( keyboards.isEmpty() ) {
+        keyboard->setDirectInput( false );
+    }
+
+}
+
+void EvdevEventLoop::closeKeyboards() {
+    while( !keyboards.isEmpty() ) {
+        closeKeyboard( keyboards.last() );
+    }
+}
+
+bool EvdevEventLoop::isOpen( const QString &path ) const {
+
+    for( auto *joystick : devices ) {
+        if( joystick && joystick->path() == path ) {
+            return true;
+        }
+    }
+
+    for( auto *evdevKeyboard : keyboards ) {
+        if( evdevKeyboard->path() == path ) {
+            return true;
+        }
+    }
+
+    return false;
+
+}
+
+void EvdevEventLoop::readHotplugEvents() {
+
+    // Large enough for several events with names
+    alignas( inotify_event ) char buffer[ 4096 ];
+
+    forever {
+
+        ssize_t bytes = ::read( inotifyFD, buffer, sizeof( buffer ) );
+
+        if( bytes <= 0 ) {
+            return;
+        }
+
+        for( char *position = buffer; position < buffer + bytes; ) {
+
+            auto *event = reinterpret_cast<inotify_event *>( position );
+            position += sizeof( inotify_event ) + event->len;
+
+            if( event->len > 0 && qstrncmp( event->name, "event", 5 ) == 0 ) {
+                openDevice( QStringLiteral( "/dev/input/" ) + QString::fromLocal8Bit( event->name ) );
+            }
+
+        }
+
+    }
+
+}
+
+#endif // Q_OS_LINUX
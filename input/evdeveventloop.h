@@ -0,0 +1,113 @@
+#ifndef EVDEVEVENTLOOP_H
+#define EVDEVEVENTLOOP_H
+
+#include <QtGlobal>
+
+#ifdef Q_OS_LINUX
+
+#include <QObject>
+#include <QThread>
+#include <QVector>
+
+#include "evdevjoystick.h"
+#include "evdevkeyboard.h"
+#include "inputeventqueue.h"
+
+#include <atomic>
+
+class Keyboard;
+
+// EvdevEventLoop is the Linux alternative to the SDLEventLoop. Instead of polling SDL on a timer, it blocks on
+// epoll for the /dev/input/event* nodes of every connected game controller, and each EvdevJoystick publishes its
+// new state the moment the kernel reports it. Controllers coming and going are picked up through inotify on
+// /dev/input.
+
+// run() blocks until stop() is called, so the EvdevEventLoop gets a thread of its own. That thread's Qt event
+// loop never runs while run() does, stop() is the only thing that may be called from another thread.
+
+// It can also read the keyboards, for the Keyboard's direct input, with or without the controllers.
+
+// Selected at startup with the "input/backend" and "input/keyboard" settings, see InputManager.
+
+class EvdevEventLoop : public QObject {
+        Q_OBJECT
+
+    public:
+
+        explicit EvdevEventLoop( QObject *parent = 0 );
+        ~EvdevEventLoop();
+
+        // Every EvdevJoystick opened from now on sends its events into these. Call this before run().
+        void setEventQueues( InputEventQueue *frontend, InputEventQueue *editMode );
+
+        // Controllers are opened unless this is turned off. Call this before run().
+        void setJoysticksEnabled( const bool enabled );
+
+        // Every keyboard found feeds 'keyboard' through Keyboard::insertKey(). Direct input is turned on once
+        // the first keyboard is open, and off again when the last one goes away. Call this before run().
+        void setKeyboard( Keyboard *keyboard );
+
+        // Whether the application has the keyboard focus. Without it, keys are only released. Any thread.
+        void setKeyboardFocus( const bool focus );
+
+        // Makes run() return, from any thread.
+        void stop();
+
+    public slots:
+
+        void run();
+
+    signals:
+
+        // The device has been moved to the thread the EvdevEventLoop was created in, which takes ownership of it.
+        void deviceConnected( InputDevice *device );
+        void deviceRemoved( int slot );
+
+        // Emitted after each batch of kernel events, from the EvdevEventLoop's thread.
+        void polled();
+
+    private:
+
+        int epollFD;
+        int inotifyFD;
+
+        // Written by stop() to wake up epoll_wait()
+        int wakeFD;
+
+        QThread *deviceThread;
+
+        // Open devices by slot, which is also their port
+        QVector<EvdevJoystick *> devices;
+
+        bool joysticksEnabled;
+
+        // Owned by the EvdevEventLoop, unlike the joysticks.
+        QVector<EvdevKeyboard *> keyboards;
+        Keyboard *keyboard;
+        std::atomic<bool> keyboardFocus;
+
+        InputEventQueue *frontendQueue;
+        InputEventQueue *editModeQueue;
+
+        // Opens every event node that's already there.
+        void scan();
+
+        void openDevice( const QString &path );
+        void closeDevice( EvdevJoystick *joystick );
+
+        // Returns false if 'fd' isn't a keyboard, the caller still owns it then.
+        bool openKeyboard( const int fd, const QString &path );
+        void closeKeyboard( EvdevKeyboard *evdevKeyboard );
+
+        // Called whenever run() returns, so the Keyboard goes back to the window's key events.
+        void closeKeyboards();
+        bool isOpen( const QString &path ) const;
+
+        // Reads inotify events and opens new event nodes.
+        void readHotplugEvents();
+
+};
+
+#endif // Q_OS_LINUX
+
+#endif // EVDEVEVENTLOOP_H
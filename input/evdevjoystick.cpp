@@ -0,0 +1,422 @@
+#include "evdevjoystick.h"
+
+#ifdef Q_OS_LINUX
+
+#include "logging.h"
+#include "profilestore.h"
+
+#include <QtEndian>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+namespace {
+
+    bool testBit( const quint8 *bits, const int bit ) {
+        return bits[ bit / 8 ] & ( 1 << ( bit % 8 ) );
+    }
+
+    // SDL's SDL_HAT_* directions
+    enum {
+        HatUp = 1,
+        HatRight = 2,
+        HatDown = 4,
+        HatLeft = 8,
+    };
+
+    // The raw state ControllerMapping::read() decodes, by SDL index.
+    struct EvdevRawJoystick {
+
+        static const int hatCount = 4;
+
+        EvdevRawJoystick( const QVector<quint8> &buttons, const QVector<qint16> &axes, const quint8 *hats )
+            : buttons( buttons ),
+              axes( axes ),
+              hats( hats ) {
+        }
+
+        quint8 button( const int index ) const {
+            return index < buttons.size() ? buttons.at( index ) : 0;
+        }
+
+        quint8 hat( const int index ) const {
+            return index < hatCount ? hats[ index ] : 0;
+        }
+
+        qint16 axis( const int index ) const {
+            return index < axes.size() ? axes.at( index ) : 0;
+        }
+
+        const QVector<quint8> &buttons;
+        const QVector<qint16> &axes;
+        const quint8 *hats;
+
+    };
+
+}
+
+EvdevJoystick::EvdevJoystick( const int fd, const QString &path, QObject *parent )
+    : InputDevice( LibretroType::DigitalGamepad, parent ),
+      deviceFD( fd ),
+      devicePath( path ),
+      qmlSlot( -1 ),
+      valid( false ),
+      dropped( false ),
+      mLayout( InputLayout::SNES ),
+      hatStates() {
+
+    mMapping.clear();
+
+    std::fill( keyMap, keyMap + KEY_CNT, -1 );
+    std::fill( absMap, absMap + ABS_CNT, -1 );
+    std::fill( hatMap, hatMap + 4, -1 );
+    std::memset( absRange, 0, sizeof( absRange ) );
+
+    // Events are stamped with the same clock as InputEvent::currentTime().
+    int clock = CLOCK_MONOTONIC;
+    ioctl( deviceFD, EVIOCSCLOCKID, &clock );
+
+    probe();
+
+    if( valid ) {
+        resync();
+    }
+
+}
+
+EvdevJoystick::~EvdevJoystick() {
+    ::close( deviceFD );
+}
+
+bool EvdevJoystick::isValid() const {
+    return valid;
+}
+
+int EvdevJoystick::fd() const {
+    return deviceFD;
+}
+
+QString EvdevJoystick::path() const {
+    return devicePath;
+}
+
+QString EvdevJoystick::guid() const {
+    return qmlGuid;
+}
+
+int EvdevJoystick::deviceIndex() const {
+    return qmlSlot;
+}
+
+void EvdevJoystick::setSlot( const int slot ) {
+    qmlSlot = slot;
+}
+
+InputLayout::Type EvdevJoystick::layout() const {
+    return mLayout.load( std::memory_order_relaxed );
+}
+
+void EvdevJoystick::setLayout( const InputLayout::Type layout ) {
+    mLayout.store( layout, std::memory_order_relaxed );
+}
+
+bool EvdevJoystick::loadMapping() {
+
+    return mMapping.fromProfile( ProfileStore::instance().find( qmlGuid.toLatin1() ) );
+
+}
+
+bool EvdevJoystick::readEvents() {
+
+    input_event events[ 64 ];
+
+    forever {
+
+        ssize_t bytes = ::read( deviceFD, events, sizeof( events ) );
+
+        if( bytes < 0 ) {
+
+            if( errno == EINTR ) {
+                continue;
+            }
+
+            // ENODEV once it's unplugged
+            return errno == EAGAIN;
+
+        }
+
+        if( bytes == 0 ) {
+            return false;
+        }
+
+        int count = static_cast<int>( bytes / sizeof( input_event ) );
+
+        for( int i = 0; i < count; ++i ) {
+
+            const input_event &event = events[ i ];
+
+            switch( event.type ) {
+
+                case EV_KEY:
+                    if( !dropped && keyMap[ event.code ] >= 0 ) {
+                        buttonStates[ keyMap[ event.code ] ] = event.value != 0;
+                    }
+
+                    break;
+
+                case EV_ABS:
+                    if( !dropped ) {
+                        setAxis( event.code, event.value );
+                    }
+
+                    break;
+
+                case EV_SYN:
+                    if( event.code == SYN_DROPPED ) {
+                        dropped = true;
+                    }
+
+                    else if( event.code == SYN_REPORT ) {
+
+                        // Everything up to here is unreliable, read the state back instead.
+                        if( dropped ) {
+                            dropped = false;
+                            resync();
+                        }
+
+                        applyFrame( static_cast<qint64>( event.time.tv_sec ) * 1000000000 + event.time.tv_usec * 1000 );
+
+                    }
+
+                    break;
+
+                default:
+                    break;
+
+            }
+
+        }
+
+    }
+
+}
+
+//
+// Private
+//
+
+void EvdevJoystick::probe() {
+
+    quint8 keyBits[ KEY_CNT / 8 + 1 ] = {};
+    quint8 absBits[ ABS_CNT / 8 + 1 ] = {};
+
+    if( ioctl( deviceFD, EVIOCGBIT( EV_KEY, sizeof( keyBits ) ), keyBits ) < 0
+        || ioctl( deviceFD, EVIOCGBIT( EV_ABS, sizeof( absBits ) ), absBits ) < 0 ) {
+        return;
+    }
+
+    // Joysticks and gamepads only, this skips keyboards and mice early.
+    if( !testBit( keyBits, BTN_JOYSTICK ) && !testBit( keyBits, BTN_GAMEPAD )
+        && !testBit( keyBits, BTN_TRIGGER_HAPPY1 ) ) {
+        return;
+    }
+
+    // SDL's order: the joystick and gamepad buttons first, then everything below them.
+    int buttons = 0;
+
+    for( int code = BTN_JOYSTICK; code < KEY_MAX; ++code ) {
+        if( testBit( keyBits, code ) ) {
+            keyMap[ code ] = static_cast<qint16>( buttons++ );
+        }
+    }
+
+    for( int code = 0; code < BTN_JOYSTICK; ++code ) {
+        if( testBit( keyBits, code ) ) {
+            keyMap[ code ] = static_cast<qint16>( buttons++ );
+        }
+    }
+
+    // Axes, skipping the hats, which are numbered on their own.
+    int axes = 0;
+
+    for( int code = 0; code < ABS_MAX; ++code ) {
+
+        if( code == ABS_HAT0X ) {
+            code = ABS_HAT3Y;
+            continue;
+        }
+
+        if( !testBit( absBits, code ) ) {
+            continue;
+        }
+
+        input_absinfo info;
+
+        if( ioctl( deviceFD, EVIOCGABS( code ), &info ) < 0 || info.maximum == info.minimum ) {
+            continue;
+        }
+
+        absMap[ code ] = static_cast<qint16>( axes++ );
+        absRange[ code ].minimum = info.minimum;
+        absRange[ code ].maximum = info.maximum;
+
+    }
+
+    int hats = 0;
+
+    for( int code = ABS_HAT0X; code <= ABS_HAT3Y; code += 2 ) {
+        if( testBit( absBits, code ) || testBit( absBits, code + 1 ) ) {
+            hatMap[ ( code - ABS_HAT0X ) / 2 ] = static_cast<qint8>( hats++ );
+        }
+    }
+
+    buttonStates.fill( 0, buttons );
+    axisStates.fill( 0, axes );
+
+    // The same GUID SDL builds on Linux: bus, vendor, product and version, each as a little endian word
+    // followed by a zero word. Devices without a vendor and product get their name instead.
+    input_id id;
+    char name[ 128 ] = {};
+
+    if( ioctl( deviceFD, EVIOCGID, &id ) < 0 ) {
+        return;
+    }
+
+    ioctl( deviceFD, EVIOCGNAME( sizeof( name ) - 1 ), name );
+    setName( QString::fromUtf8( name ) );
+
+    SDL_JoystickGUID guid;
+    std::memset( guid.data, 0, sizeof( guid.data ) );
+
+    quint16 *words = reinterpret_cast<quint16 *>( guid.data );
+    words[ 0 ] = qToLittleEndian<quint16>( id.bustype );
+
+    if( id.vendor && id.product ) {
+        words[ 2 ] = qToLittleEndian<quint16>( id.vendor );
+        words[ 4 ] = qToLittleEndian<quint16>( id.product );
+        words[ 6 ] = qToLittleEndian<quint16>( id.version );
+    }
+
+    else {
+        std::strncpy( reinterpret_cast<char *>( guid.data + 4 ), name, sizeof( guid.data ) - 4 );
+    }
+
+    char guidString[ 33 ];
+    SDL_JoystickGetGUIDString( guid, guidString, sizeof( guidString ) );
+    qmlGuid = guidString;
+
+    const ControllerDBEntry *entry = ControllerDB::instance().find( guid );
+
+    if( !entry ) {
+        qCDebug( phxInput ) << devicePath << name << "has no controller mapping, ignored";
+        return;
+    }
+
+    mMapping = entry->mapping;
+    valid = true;
+
+}
+
+void EvdevJoystick::resync() {
+
+    quint8 keyStates[ KEY_CNT / 8 + 1 ] = {};
+
+    if( ioctl( deviceFD, EVIOCGKEY( sizeof( keyStates ) ), keyStates ) >= 0 ) {
+        for( int code = 0; code < KEY_CNT; ++code ) {
+            if( keyMap[ code ] >= 0 ) {
+                buttonStates[ keyMap[ code ] ] = testBit( keyStates, code );
+            }
+        }
+    }
+
+    for( int code = 0; code < ABS_CNT; ++code ) {
+
+        bool isHat = code >= ABS_HAT0X && code <= ABS_HAT3Y;
+
+        if( absMap[ code ] < 0 && !( isHat && hatMap[ ( code - ABS_HAT0X ) / 2 ] >= 0 ) ) {
+            continue;
+        }
+
+        input_absinfo info;
+
+        if( ioctl( deviceFD, EVIOCGABS( code ), &info ) >= 0 ) {
+            setAxis( code, info.value );
+        }
+
+    }
+
+}
+
+void EvdevJoystick::setAxis( const int code, const int value ) {
+
+    if( code >= ABS_HAT0X && code <= ABS_HAT3Y ) {
+
+        int hat = hatMap[ ( code - ABS_HAT0X ) / 2 ];
+
+        if( hat < 0 ) {
+            return;
+        }
+
+        // Even codes are X, odd codes are Y.
+        bool isX = ( code - ABS_HAT0X ) % 2 == 0;
+        quint8 negative = isX ? HatLeft : HatUp;
+        quint8 positive = isX ? HatRight : HatDown;
+
+        quint8 &state = hatStates[ hat ];
+        state &= ~( negative | positive );
+        state |= value < 0 ? negative : value > 0 ? positive : 0;
+
+        return;
+
+    }
+
+    int axis = absMap[ code ];
+
+    if( axis < 0 ) {
+        return;
+    }
+
+    // Scale the device's range to SDL's.
+    const AxisRange &range = absRange[ code ];
+    qint64 scaled = ( static_cast<qint64>( value ) - range.minimum ) * 65535 / ( range.maximum - range.minimum ) - 32768;
+    axisStates[ axis ] = static_cast<qint16>( qBound<qint64>( -32768, scaled, 32767 ) );
+
+}
+
+void EvdevJoystick::applyFrame( const qint64 time ) {
+
+    JoystickState pad = readAll();
+
+    // Remapping wants raw SDL buttons instead of port state.
+    if( editMode() ) {
+
+        quint32 changed = pad.buttons ^ previousPad.buttons;
+
+        for( int button = 0; changed; ++button, changed >>= 1 ) {
+            if( changed & 1 ) {
+                emitEditModeEvent( button, pad.isPressed( static_cast<SDL_GameControllerButton>( button ) ) );
+            }
+        }
+
+        previousPad = pad;
+        return;
+
+    }
+
+    previousPad = pad;
+
+    insertState( InputLayout::translate( layout(), pad ), time );
+    publishStates();
+
+}
+
+JoystickState EvdevJoystick::readAll() const {
+    return mMapping.read( EvdevRawJoystick( buttonStates, axisStates, hatStates ) );
+}
+
+#endif // Q_OS_LINUX
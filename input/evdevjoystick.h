@@ -0,0 +1,105 @@
+#ifndef EVDEVJOYSTICK_H
+#define EVDEVJOYSTICK_H
+
+#include <QtGlobal>
+
+#ifdef Q_OS_LINUX
+
+#include <QString>
+#include <QVector>
+
+#include <linux/input.h>
+
+#include "inputdevice.h"
+#include "controllerdb.h"
+#include "inputlayout.h"
+#include "joystickstate.h"
+
+// EvdevJoystick reads a game controller straight from its /dev/input/event* node, without SDL.
+
+// Buttons, axes and hats are numbered the same way SDL numbers them on Linux, and the GUID is built the same way,
+// so the gamecontrollerdb.txt mappings in the ControllerDB apply unchanged. Only devices the ControllerDB has a
+// mapping for are accepted, just like SDL only opens devices it knows as game controllers.
+
+// The device is fed by the EvdevEventLoop's thread: every complete kernel frame (SYN_REPORT) is translated and
+// published as soon as it's read, stamped with the kernel's own monotonic timestamp.
+
+class EvdevJoystick : public InputDevice {
+
+    public:
+
+        // Takes ownership of 'fd', which must be open for non-blocking reads.
+        explicit EvdevJoystick( const int fd, const QString &path, QObject *parent = 0 );
+        ~EvdevJoystick();
+
+        // False if the device isn't a game controller with a known mapping.
+        bool isValid() const;
+
+        int fd() const;
+        QString path() const;
+        QString guid() const;
+
+        // The port it's assigned to, see EvdevEventLoop.
+        int deviceIndex() const override;
+        void setSlot( const int slot );
+
+        // Set from any thread, see InputLayout.
+        InputLayout::Type layout() const;
+        void setLayout( const InputLayout::Type layout );
+
+        // The user's own mapping for the GUID, saved by a Joystick, replaces the ControllerDB's. See ProfileStore.
+        bool loadMapping() override;
+
+        // Reads every pending event and publishes each complete frame. Returns false once the device is gone.
+        bool readEvents();
+
+    private:
+
+        int deviceFD;
+        QString devicePath;
+        QString qmlGuid;
+        int qmlSlot;
+        bool valid;
+
+        // Set by SYN_DROPPED, the kernel's buffer overflowed and the state has to be read back in full.
+        bool dropped;
+
+        std::atomic<InputLayout::Type> mLayout;
+        ControllerMapping mMapping;
+
+        // Kernel codes to SDL's raw button, axis and hat indices, -1 if the device doesn't have it.
+        qint16 keyMap[ KEY_CNT ];
+        qint16 absMap[ ABS_CNT ];
+        qint8 hatMap[ 4 ];
+
+        struct AxisRange {
+            int minimum;
+            int maximum;
+        };
+
+        AxisRange absRange[ ABS_CNT ];
+
+        // Raw state, by SDL index
+        QVector<quint8> buttonStates;
+        QVector<qint16> axisStates;
+        quint8 hatStates[ 4 ];
+
+        // The last translated frame, to find edges in edit mode
+        JoystickState previousPad;
+
+        // Fills the maps in SDL's order, builds the GUID and looks up the mapping.
+        void probe();
+
+        // Reads the whole state back after SYN_DROPPED.
+        void resync();
+
+        void setAxis( const int code, const int value );
+        void applyFrame( const qint64 time );
+
+        JoystickState readAll() const;
+
+};
+
+#endif // Q_OS_LINUX
+
+#endif // EVDEVJOYSTICK_H
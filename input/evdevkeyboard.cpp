@@ -0,0 +1,219 @@
+#include "evdevkeyboard.h"
+
+#ifdef Q_OS_LINUX
+
+#include "keyboard.h"
+
+#include <cerrno>
+#include <ctime>
+#include <linux/input.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+namespace {
+
+    bool testBit( const quint8 *bits, const int bit ) {
+        return bits[ bit / 8 ] & ( 1 << ( bit % 8 ) );
+    }
+
+    // Up to KEY_COMPOSE covers a PC keyboard's main block, keypad and navigation keys.
+    const int keyTableSize = KEY_COMPOSE + 1;
+
+    struct KeyTable {
+        int keys[ keyTableSize ];
+
+        KeyTable() : keys() {
+
+            static const int letters[] = {
+                KEY_A, KEY_B, KEY_C, KEY_D, KEY_E, KEY_F, KEY_G, KEY_H, KEY_I, KEY_J, KEY_K, KEY_L, KEY_M,
+                KEY_N, KEY_O, KEY_P, KEY_Q, KEY_R, KEY_S, KEY_T, KEY_U, KEY_V, KEY_W, KEY_X, KEY_Y, KEY_Z,
+            };
+
+            for( int i = 0; i < 26; ++i ) {
+                keys[ letters[ i ] ] = Qt::Key_A + i;
+            }
+
+            // KEY_1 to KEY_0 are contiguous, so are KEY_F1 to KEY_F10.
+            for( int i = 0; i < 9; ++i ) {
+                keys[ KEY_1 + i ] = Qt::Key_1 + i;
+            }
+
+            keys[ KEY_0 ] = Qt::Key_0;
+
+            for( int i = 0; i < 10; ++i ) {
+                keys[ KEY_F1 + i ] = Qt::Key_F1 + i;
+            }
+
+            keys[ KEY_F11 ] = Qt::Key_F11;
+            keys[ KEY_F12 ] = Qt::Key_F12;
+
+            keys[ KEY_ESC ] = Qt::Key_Escape;
+            keys[ KEY_MINUS ] = Qt::Key_Minus;
+            keys[ KEY_EQUAL ] = Qt::Key_Equal;
+            keys[ KEY_BACKSPACE ] = Qt::Key_Backspace;
+            keys[ KEY_TAB ] = Qt::Key_Tab;
+            keys[ KEY_LEFTBRACE ] = Qt::Key_BracketLeft;
+            keys[ KEY_RIGHTBRACE ] = Qt::Key_BracketRight;
+            keys[ KEY_ENTER ] = Qt::Key_Return;
+            keys[ KEY_SEMICOLON ] = Qt::Key_Semicolon;
+            keys[ KEY_APOSTROPHE ] = Qt::Key_Apostrophe;
+            keys[ KEY_GRAVE ] = Qt::Key_QuoteLeft;
+            keys[ KEY_BACKSLASH ] = Qt::Key_Backslash;
+            keys[ KEY_COMMA ] = Qt::Key_Comma;
+            keys[ KEY_DOT ] = Qt::Key_Period;
+            keys[ KEY_SLASH ] = Qt::Key_Slash;
+            keys[ KEY_SPACE ] = Qt::Key_Space;
+            keys[ KEY_CAPSLOCK ] = Qt::Key_CapsLock;
+            keys[ KEY_NUMLOCK ] = Qt::Key_NumLock;
+            keys[ KEY_SCROLLLOCK ] = Qt::Key_ScrollLock;
+            keys[ KEY_SYSRQ ] = Qt::Key_Print;
+            keys[ KEY_PAUSE ] = Qt::Key_Pause;
+            keys[ KEY_COMPOSE ] = Qt::Key_Menu;
+
+            // Qt doesn't tell left and right modifiers apart.
+            keys[ KEY_LEFTSHIFT ] = Qt::Key_Shift;
+            keys[ KEY_RIGHTSHIFT ] = Qt::Key_Shift;
+            keys[ KEY_LEFTCTRL ] = Qt::Key_Control;
+            keys[ KEY_RIGHTCTRL ] = Qt::Key_Control;
+            keys[ KEY_LEFTALT ] = Qt::Key_Alt;
+            keys[ KEY_RIGHTALT ] = Qt::Key_AltGr;
+            keys[ KEY_LEFTMETA ] = Qt::Key_Meta;
+            keys[ KEY_RIGHTMETA ] = Qt::Key_Meta;
+
+            keys[ KEY_HOME ] = Qt::Key_Home;
+            keys[ KEY_END ] = Qt::Key_End;
+            keys[ KEY_PAGEUP ] = Qt::Key_PageUp;
+            keys[ KEY_PAGEDOWN ] = Qt::Key_PageDown;
+            keys[ KEY_INSERT ] = Qt::Key_Insert;
+            keys[ KEY_DELETE ] = Qt::Key_Delete;
+            keys[ KEY_UP ] = Qt::Key_Up;
+            keys[ KEY_DOWN ] = Qt::Key_Down;
+            keys[ KEY_LEFT ] = Qt::Key_Left;
+            keys[ KEY_RIGHT ] = Qt::Key_Right;
+
+            // The keypad reports the same keys as the main block, Qt only adds Qt::KeypadModifier.
+            keys[ KEY_KP0 ] = Qt::Key_0;
+            keys[ KEY_KP1 ] = Qt::Key_1;
+            keys[ KEY_KP2 ] = Qt::Key_2;
+            keys[ KEY_KP3 ] = Qt::Key_3;
+            keys[ KEY_KP4 ] = Qt::Key_4;
+            keys[ KEY_KP5 ] = Qt::Key_5;
+            keys[ KEY_KP6 ] = Qt::Key_6;
+            keys[ KEY_KP7 ] = Qt::Key_7;
+            keys[ KEY_KP8 ] = Qt::Key_8;
+            keys[ KEY_KP9 ] = Qt::Key_9;
+            keys[ KEY_KPMINUS ] = Qt::Key_Minus;
+            keys[ KEY_KPPLUS ] = Qt::Key_Plus;
+            keys[ KEY_KPDOT ] = Qt::Key_Period;
+            keys[ KEY_KPASTERISK ] = Qt::Key_Asterisk;
+            keys[ KEY_KPSLASH ] = Qt::Key_Slash;
+            keys[ KEY_KPENTER ] = Qt::Key_Enter;
+
+        }
+    };
+
+}
+
+EvdevKeyboard::EvdevKeyboard( const int fd, const QString &path )
+    : deviceFD( fd ),
+      devicePath( path ) {
+
+    // Events are stamped with the same clock as InputEvent::currentTime().
+    int clock = CLOCK_MONOTONIC;
+    ioctl( deviceFD, EVIOCSCLOCKID, &clock );
+
+}
+
+EvdevKeyboard::~EvdevKeyboard() {
+    ::close( deviceFD );
+}
+
+bool EvdevKeyboard::isKeyboard( const int fd ) {
+
+    quint8 evBits[ ( EV_CNT + 7 ) / 8 ] = {};
+    quint8 keyBits[ ( KEY_CNT + 7 ) / 8 ] = {};
+
+    if( ioctl( fd, EVIOCGBIT( 0, sizeof( evBits ) ), evBits ) < 0
+        || ioctl( fd, EVIOCGBIT( EV_KEY, sizeof( keyBits ) ), keyBits ) < 0 ) {
+        return false;
+    }
+
+    return testBit( evBits, EV_KEY ) && testBit( keyBits, KEY_A ) && testBit( keyBits, KEY_Z )
+           && testBit( keyBits, KEY_SPACE ) && testBit( keyBits, KEY_ENTER );
+
+}
+
+int EvdevKeyboard::fd() const {
+    return deviceFD;
+}
+
+QString EvdevKeyboard::path() const {
+    return devicePath;
+}
+
+bool EvdevKeyboard::readEvents( Keyboard *keyboard, const bool focus ) {
+
+    input_event events[ 64 ];
+
+    forever {
+
+        ssize_t bytes = ::read( deviceFD, events, sizeof( events ) );
+
+        if( bytes < 0 ) {
+
+            if( errno == EINTR ) {
+                continue;
+            }
+
+            // ENODEV once it's unplugged
+            return errno == EAGAIN;
+
+        }
+
+        if( bytes == 0 ) {
+            return false;
+        }
+
+        int count = static_cast<int>( bytes / sizeof( input_event ) );
+
+        for( int i = 0; i < count; ++i ) {
+
+            const input_event &event = events[ i ];
+
+            // Auto-repeat (2) changes nothing.
+            if( event.type != EV_KEY || event.value == 2 ) {
+                continue;
+            }
+
+            bool pressed = event.value != 0;
+
+            if( pressed && !focus ) {
+                continue;
+            }
+
+            int key = toQtKey( event.code );
+
+            if( key ) {
+                qint64 time = static_cast<qint64>( event.time.tv_sec ) * 1000000000 + event.time.tv_usec * 1000;
+                keyboard->insertKey( key, pressed, time );
+            }
+
+        }
+
+    }
+
+}
+
+int EvdevKeyboard::toQtKey( const int code ) {
+
+    static const KeyTable table;
+
+    if( code < 0 || code >= keyTableSize ) {
+        return 0;
+    }
+
+    return table.keys[ code ];
+
+}
+
+#endif // Q_OS_LINUX
@@ -0,0 +1,50 @@
+#ifndef EVDEVKEYBOARD_H
+#define EVDEVKEYBOARD_H
+
+#include <QtGlobal>
+
+#ifdef Q_OS_LINUX
+
+#include <QString>
+
+class Keyboard;
+
+// EvdevKeyboard reads a keyboard straight from its /dev/input/event* node and feeds the Keyboard with it from the
+// EvdevEventLoop's thread, so key presses never wait behind QML painting in the GUI thread's event queue.
+
+// Linux key codes are translated to the Qt::Key the window would have reported for the same key without any
+// modifiers, so the Keyboard's mapping applies unchanged.
+
+class EvdevKeyboard {
+
+    public:
+
+        // Takes ownership of 'fd', which must be open for non-blocking reads.
+        explicit EvdevKeyboard( const int fd, const QString &path );
+        ~EvdevKeyboard();
+
+        // False if the device doesn't look like a keyboard (mice and power buttons report keys too).
+        static bool isKeyboard( const int fd );
+
+        int fd() const;
+        QString path() const;
+
+        // Reads every pending event into 'keyboard'. Without 'focus' only releases go through, so keys
+        // held while the window lost focus don't get stuck. Returns false once the device is gone.
+        bool readEvents( Keyboard *keyboard, const bool focus );
+
+        // The Qt::Key for a Linux KEY_* code, 0 if there is none.
+        static int toQtKey( const int code );
+
+    private:
+
+        Q_DISABLE_COPY( EvdevKeyboard )
+
+        int deviceFD;
+        QString devicePath;
+
+};
+
+#endif // Q_OS_LINUX
+
+#endif // EVDEVKEYBOARD_H
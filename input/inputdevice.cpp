@@ -4,32 +4,23 @@
 // Constructors
 //
 
-bool InputDevice::gamepadControlsFrontend = true;
+std::atomic<bool> InputDevice::gamepadControlsFrontend( true );
+
+const int16_t InputDevice::axisEventThreshold = 4096;
 
 InputDevice::InputDevice( const InputDevice::LibretroType type, const QString name, QObject *parent )
     : QObject( parent ),
-      deviceStates( std::unique_ptr<InputStateMap> ( new InputStateMap {
-        { InputDeviceEvent::B, false },
-        { InputDeviceEvent::A, false },
-        { InputDeviceEvent::X, false },
-        { InputDeviceEvent::Y, false },
-        { InputDeviceEvent::Up, false },
-        { InputDeviceEvent::Down, false },
-        { InputDeviceEvent::Right, false },
-        { InputDeviceEvent::Left, false },
-        { InputDeviceEvent::R, false },
-        { InputDeviceEvent::L, false },
-        { InputDeviceEvent::L2, false },
-        { InputDeviceEvent::R2, false },
-        { InputDeviceEvent::R3, false },
-        { InputDeviceEvent::L3, false },
-        { InputDeviceEvent::Start, false },
-        { InputDeviceEvent::Select, false },
-    } ) ),
-    deviceType( type ),
-    deviceName( name ),
-    qmlEditMode( false ),
-    qmlResetMapping( false ) {
+      frontendQueue( nullptr ),
+      editModeQueue( nullptr ),
+      deviceType( type ),
+      suppressedEvents( 0 ),
+      sampleTime( 0 ),
+      publishedButtons( 0 ),
+      pressedButtons( 0 ),
+      pendingEdgeTime( 0 ),
+      deviceName( name ),
+      qmlEditMode( false ),
+      qmlResetMapping( false ) {
     setRetroButtonCount( 15 );
 }
 
@@ -71,8 +62,42 @@ InputDevice::LibretroType InputDevice::type() const {
     return deviceType;
 }
 
-InputStateMap *InputDevice::states() {
-    return deviceStates.get();
+quint64 InputDevice::suppressedEventCount() const {
+    return suppressedEvents.load( std::memory_order_relaxed );
+}
+
+int InputDevice::deviceIndex() const {
+    return -1;
+}
+
+InputState *InputDevice::states() {
+    return &deviceStates;
+}
+
+InputState InputDevice::snapshot() const {
+    return publishedStates.load();
+}
+
+InputState InputDevice::latchState() {
+    observeEdge();
+    return publishedStates.load();
+}
+
+quint32 InputDevice::takePressedButtons() {
+
+    // Nothing to reset most of the time.
+    if( pressedButtons.load( std::memory_order_relaxed ) == 0 ) {
+        return 0;
+    }
+
+    return pressedButtons.exchange( 0, std::memory_order_relaxed );
+
+}
+
+void InputDevice::markPressed( const quint32 buttons ) {
+    if( buttons ) {
+        pressedButtons.fetch_or( buttons, std::memory_order_relaxed );
+    }
 }
 
 void InputDevice::setName( const QString name ) {
@@ -94,6 +119,11 @@ void InputDevice::setType( const InputDevice::LibretroType type ) {
     deviceType = type;
 }
 
+void InputDevice::setEventQueues( InputEventQueue *frontend, InputEventQueue *editMode ) {
+    frontendQueue = frontend;
+    editModeQueue = editMode;
+}
+
 void InputDevice::saveMapping() {
     return;
 }
@@ -102,7 +132,57 @@ bool InputDevice::loadMapping() {
     return false;
 }
 
+const LatencyHistogram &InputDevice::latency() const {
+    return inputLatency;
+}
+
+void InputDevice::resetLatency() {
+    pendingEdgeTime.store( 0, std::memory_order_relaxed );
+    inputLatency.reset();
+}
+
+void InputDevice::emitEditModeEvent( int event, int state ) {
+
+    if( !editModeQueue ) {
+        emit editModeEvent( event, state );
+        return;
+    }
+
+    InputEvent inputEvent;
+    inputEvent.device = static_cast<qint16>( deviceIndex() );
+    inputEvent.event = static_cast<qint16>( event );
+    inputEvent.value = static_cast<int16_t>( state );
+    inputEvent.timestamp = InputEvent::currentTime();
+
+    editModeQueue->push( inputEvent );
+
+}
+
+void InputDevice::publishStates() {
+
+    publishedStates.store( deviceStates );
+
+    if( deviceStates.buttons == publishedButtons ) {
+        return;
+    }
+
+    markPressed( deviceStates.buttons & ~publishedButtons );
+    publishedButtons = deviceStates.buttons;
+
+    // Nobody's measuring outside of a game, don't leave a stale edge for the next one.
+    if( InputDevice::gamepadControlsFrontend.load( std::memory_order_relaxed ) ) {
+        pendingEdgeTime.store( 0, std::memory_order_relaxed );
+        return;
+    }
+
+    // Only the oldest unread edge counts, later ones are read by the same value() call.
+    qint64 none = 0;
+    pendingEdgeTime.compare_exchange_strong( none, sampleTime, std::memory_order_relaxed );
+
+}
+
 void InputDevice::selfDestruct() {
+    qCDebug( phxInput ) << name() << "skipped" << suppressedEventCount() << "unchanged frontend events";
     saveMapping();
     delete this;
 }
@@ -112,21 +192,41 @@ void InputDevice::selfDestruct() {
 //
 
 int16_t InputDevice::value( const InputDeviceEvent::Event &event, const int16_t defaultValue ) {
-    mutex.lock();
-    auto pressed = deviceStates->value( event, defaultValue );
-    mutex.unlock();
-    return pressed;
+
+    if( InputState::bit( event ) < 0 ) {
+        return defaultValue;
+    }
+
+    observeEdge();
+    return publishedStates.load().value( event );
+
 }
 
 void InputDevice::insert( const InputDeviceEvent::Event &value, const int16_t &state ) {
-    mutex.lock();
 
-    if( InputDevice::gamepadControlsFrontend ) {
-        emit inputDeviceEvent( value, state );
+    deviceStates.insert( value, state );
+    sampleTime = InputEvent::currentTime();
+
+    emitIfChanged( value, state );
+
+}
+
+void InputDevice::insertState( const InputState &state, const qint64 time ) {
+
+    deviceStates = state;
+    sampleTime = time;
+
+    emitIfChanged( InputDeviceEvent::Guide, state.value( InputDeviceEvent::Guide ) );
+
+    if( !InputDevice::gamepadControlsFrontend.load( std::memory_order_relaxed ) ) {
+        return;
+    }
+
+    for( int i = 0; i < InputDeviceEvent::Unknown; ++i ) {
+        auto event = static_cast<InputDeviceEvent::Event>( i );
+        emitIfChanged( event, state.value( event ) );
     }
 
-    deviceStates->insert( value, state );
-    mutex.unlock();
 }
 
 void InputDevice::setMapping( const QVariantMap mapping ) {
@@ -139,9 +239,70 @@ void InputDevice::setMapping( const QVariantMap mapping ) {
 //
 
 void InputDevice::resetStates() {
-    for( auto &key : deviceStates->keys() ) {
-        deviceStates->value( key, false );
+    deviceStates = InputState();
+}
+
+bool InputDevice::isSignificantChange( const InputDeviceEvent::Event &event,
+                                       const int16_t emitted, const int16_t state ) {
+
+    // Press or release
+    if( ( emitted != 0 ) != ( state != 0 ) ) {
+        return true;
+    }
+
+    // Against what the frontend last got, so a slow but steady movement still adds up to an event.
+    if( InputState::axis( event ) >= 0 ) {
+        return qAbs( state - emitted ) >= axisEventThreshold;
+    }
+
+    return false;
+
+}
+
+void InputDevice::emitIfChanged( const InputDeviceEvent::Event &event, const int16_t state ) {
+
+    if( !InputDevice::gamepadControlsFrontend.load( std::memory_order_relaxed ) && event != InputDeviceEvent::Guide ) {
+        return;
+    }
+
+    if( !isSignificantChange( event, emittedStates.value( event ), state ) ) {
+        suppressedEvents.fetch_add( 1, std::memory_order_relaxed );
+        return;
     }
+
+    emittedStates.insert( event, state );
+
+    if( frontendQueue ) {
+
+        InputEvent inputEvent;
+        inputEvent.device = static_cast<qint16>( deviceIndex() );
+        inputEvent.event = static_cast<qint16>( event );
+        inputEvent.value = state;
+        inputEvent.timestamp = sampleTime;
+
+        frontendQueue->push( inputEvent );
+
+    }
+
+    else {
+        emit inputDeviceEvent( event, state );
+    }
+
+}
+
+void InputDevice::observeEdge() {
+
+    // One relaxed load when there's nothing to measure.
+    if( pendingEdgeTime.load( std::memory_order_relaxed ) == 0 ) {
+        return;
+    }
+
+    qint64 edgeTime = pendingEdgeTime.exchange( 0, std::memory_order_relaxed );
+
+    if( edgeTime != 0 ) {
+        inputLatency.record( InputEvent::currentTime() - edgeTime );
+    }
+
 }
 
 void InputDevice::setRetroButtonCount( const int count ) {
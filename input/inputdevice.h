@@ -2,7 +2,6 @@
 #define INPUTDEVICE
 
 #include <QObject>
-#include <QMutex>
 #include <QHash>
 #include <QDebug>
 #include <QMap>
@@ -10,11 +9,15 @@
 #include <QVariantMap>
 #include <QSettings>
 #include <QFile>
-#include <memory>
+#include <atomic>
 
 #include "libretro.h"
 #include "logging.h"
 #include "inputdeviceevent.h"
+#include "inputeventqueue.h"
+#include "latencyhistogram.h"
+#include "inputstate.h"
+#include "seqlock.h"
 
 // InputDevice represents an abstract controller.
 
@@ -25,8 +28,17 @@
 // 'inputDevice->selfDestruct'. This is because changes to the InputDevice's mapping are only written to a save file
 // when the application closes.
 
-// Use alias so we don't have to type this out every time. :/
-using InputStateMap = QHash<InputDeviceEvent::Event, int16_t>;
+// Threading: insert() and publishStates() are only called by the thread that feeds the device (the input
+// thread for a Joystick, the GUI thread for the Keyboard). Any other thread reads through value() or snapshot(),
+// which never lock and never block the writer.
+
+// Once setEventQueues() has been called, frontend and edit mode events are pushed into those queues
+// instead of being emitted as inputDeviceEvent() and editModeEvent().
+
+// While a game is running, the time between a button being sampled and the core first reading it
+// through value() or latchState() is recorded in latency(). Samples are taken by the device's own thread, on the
+// SDLEventLoop's poll timer or as evdev reports them, never by the reader, so this includes the wait for the
+// core's next frame. It doesn't include the time a press spends waiting for the next SDL poll.
 
 class InputDevice : public QObject {
         Q_OBJECT
@@ -39,7 +51,11 @@ class InputDevice : public QObject {
 
         // This should be turned off when a game is running
         // and set to true when the game stops. The setRun function of InputManager toggles this.
-        static bool gamepadControlsFrontend;
+        // Read by every device's own thread, a relaxed load is enough since nothing else is published with it.
+        static std::atomic<bool> gamepadControlsFrontend;
+
+        // An analog value has to move at least this much before it is sent to the frontend again.
+        static const int16_t axisEventThreshold;
 
         // Controller types from libretro's perspective
         enum  LibretroType {
@@ -65,7 +81,35 @@ class InputDevice : public QObject {
         QString mappingString() const;
         bool resetMapping() const;// QML
         LibretroType type() const;
-        InputStateMap *states();
+
+        // How many inputDeviceEvent() emissions were skipped because the value didn't change.
+        quint64 suppressedEventCount() const;
+
+        // Sample to first read latency of button edges, only recorded while a game is running.
+        const LatencyHistogram &latency() const;
+
+        // Don't call this while a game is running.
+        void resetLatency();
+
+        // Identifies this device in an InputEvent. -1 unless a subclass says otherwise.
+        virtual int deviceIndex() const;
+
+        // The writer's working copy of the states, don't touch this from any other thread.
+        InputState *states();
+
+        // Read every button and axis of this device at once.
+        InputState snapshot() const;
+
+        // snapshot() for the core, this counts as the core reading the state for latency().
+        InputState latchState();
+
+        // Buttons that were pressed at any point since the last call, whether they're still held or were
+        // released again before anyone sampled them.
+        quint32 takePressedButtons();
+
+        // Adds to takePressedButtons() from the device's thread, for presses seen outside of insert(),
+        // like SDL button events.
+        void markPressed( const quint32 buttons );
 
         // Setters
         void setName( const QString name ); // QML
@@ -74,10 +118,21 @@ class InputDevice : public QObject {
 
         void setType( const LibretroType type );
 
+        // The queues belong to the InputManager and must outlive the device. Set them before the device's
+        // thread starts feeding it, either one may be null.
+        void setEventQueues( InputEventQueue *frontend, InputEventQueue *editMode );
+
         virtual void saveMapping();
 
         virtual bool loadMapping();
 
+        // Sends a raw button event to whoever is remapping the device, through the edit mode queue if
+        // there is one. Called from the device's thread.
+        void emitEditModeEvent( int event, int state );
+
+        // Makes everything insert()'ed since the last call visible to value() and snapshot().
+        void publishStates();
+
         // This is the only you we should be deleting the InputDevice.
         // This function calls saveMapping() before it deletes itself.
         void selfDestruct();
@@ -87,16 +142,25 @@ class InputDevice : public QObject {
         // Poll button state (getter)
         virtual int16_t value( const InputDeviceEvent::Event &event, const int16_t defaultValue = 0 );
 
-        // Set button state (setter)
+        // Set button state (setter). inputDeviceEvent() is only emitted when a button is pressed or released,
+        // or when an analog value moves past axisEventThreshold. The Guide button always reaches
+        // the frontend, even when a game is running.
         virtual void insert( const InputDeviceEvent::Event &value, const int16_t &state );
 
+        // Replace every button and axis at once, with the same change-only emission as insert().
+        // 'time' is when the state was read from the hardware, see InputEvent::currentTime().
+        void insertState( const InputState &state, const qint64 time );
+
         // Set the device -> SDL2 gamepad mapping
         virtual void setMapping( const QVariantMap mapping );
 
     protected:
 
         // The device's current state (whether certain buttons are pressed)
-        std::unique_ptr<InputStateMap> deviceStates;
+        InputState deviceStates;
+
+        InputEventQueue *frontendQueue;
+        InputEventQueue *editModeQueue;
 
     signals:
 
@@ -119,8 +183,34 @@ class InputDevice : public QObject {
         // Type of controller this input device is
         LibretroType deviceType;
 
-        // Controller states are read by a different thread, lock access with a mutex
-        QMutex mutex;
+        // Controller states are read by a different thread, this is what they read
+        SeqLock<InputState> publishedStates;
+
+        std::atomic<quint64> suppressedEvents;
+
+        // When the working copy was last sampled, used for InputEvent timestamps and latency.
+        qint64 sampleTime;
+
+        // The buttons as of the last publishStates(), to spot edges. Writer only.
+        quint32 publishedButtons;
+
+        // Presses published since the last takePressedButtons()
+        std::atomic<quint32> pressedButtons;
+
+        // Sample time of the oldest published edge the core hasn't read yet, 0 if there's none.
+        std::atomic<qint64> pendingEdgeTime;
+        LatencyHistogram inputLatency;
+
+        // The values last sent to the frontend, to compare against. Writer only.
+        InputState emittedStates;
+
+        static bool isSignificantChange( const InputDeviceEvent::Event &event,
+                                         const int16_t emitted, const int16_t state );
+
+        void emitIfChanged( const InputDeviceEvent::Event &event, const int16_t state );
+
+        // Records the latency of the pending edge, if there is one.
+        void observeEdge();
 
         // Clear button states
         void resetStates();
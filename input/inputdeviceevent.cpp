@@ -1,125 +1,151 @@
 #include "inputdeviceevent.h"
 
+// Both directions are table lookups, without any allocation. The names are SDL's, as returned by
+// SDL_GameControllerGetStringForButton() and SDL_GameControllerGetStringForAxis() (for the triggers).
+
+namespace {
+
+    struct EventName {
+        const char *name;
+        int length;
+        InputDeviceEvent::Event event;
+    };
+
+#define NAME( string, value ) { string, sizeof( string ) - 1, InputDeviceEvent::value }
+#define EMPTY { nullptr, 0, InputDeviceEvent::Unknown }
+
+    // Each name's hash is distinct over every name in eventNames, which makes it a perfect hash: one lookup and
+    // one comparison. Any name that's added has to keep it that way, the static_assert below checks it.
+    const int tableSize = 32;
+
+    constexpr unsigned code( const char c ) {
+        return static_cast<unsigned char>( c );
+    }
+
+    inline unsigned code( const QChar c ) {
+        return c.unicode();
+    }
+
+    template<typename Char>
+    constexpr int hash( const Char *name, const int length ) {
+        return static_cast<int>( length + 4 * code( name[ 0 ] ) + 2 * code( name[ length / 2 ] )
+                                 + 16 * code( name[ length - 1 ] ) ) & ( tableSize - 1 );
+    }
+
+    // By hash. Generated from the names and the hash above.
+    constexpr EventName eventNames[ tableSize ] = {
+        NAME( "dpleft", Left ),
+        EMPTY,
+        NAME( "back", Select ),
+        NAME( "guide", Guide ),
+        EMPTY,
+        NAME( "rightshoulder", R ),
+        EMPTY,
+        NAME( "y", Y ),
+        NAME( "rightstick", R3 ),
+        NAME( "dpright", Right ),
+        EMPTY,
+        EMPTY,
+        EMPTY,
+        NAME( "b", B ),
+        EMPTY,
+        NAME( "leftstick", L3 ),
+        EMPTY,
+        NAME( "x", X ),
+        EMPTY,
+        NAME( "start", Start ),
+        NAME( "dpdown", Down ),
+        EMPTY,
+        EMPTY,
+        NAME( "a", A ),
+        NAME( "righttrigger", R2 ),
+        EMPTY,
+        NAME( "leftshoulder", L ),
+        EMPTY,
+        NAME( "select", Select ), // Legacy
+        NAME( "dup", Up ), // Legacy
+        NAME( "dpup", Up ),
+        NAME( "lefttrigger", L2 ),
+    };
+
+    // By event, starting with the Guide button (-1).
+    constexpr EventName canonicalNames[ InputDeviceEvent::Unknown + 1 ] = {
+        NAME( "guide", Guide ),
+        NAME( "b", B ),
+        NAME( "y", Y ),
+        NAME( "back", Select ),
+        NAME( "start", Start ),
+        NAME( "dpup", Up ),
+        NAME( "dpdown", Down ),
+        NAME( "dpleft", Left ),
+        NAME( "dpright", Right ),
+        NAME( "a", A ),
+        NAME( "x", X ),
+        NAME( "leftshoulder", L ),
+        NAME( "rightshoulder", R ),
+        NAME( "lefttrigger", L2 ),
+        NAME( "righttrigger", R2 ),
+        NAME( "leftstick", L3 ),
+        NAME( "rightstick", R3 ),
+    };
+
+#undef NAME
+#undef EMPTY
+
+    constexpr bool hashesToSlot( const int slot ) {
+        return slot == tableSize
+               || ( ( eventNames[ slot ].length == 0 || hash( eventNames[ slot ].name, eventNames[ slot ].length ) == slot )
+                    && hashesToSlot( slot + 1 ) );
+    }
+
+    constexpr bool inEventOrder( const int index ) {
+        return index == InputDeviceEvent::Unknown + 1
+               || ( canonicalNames[ index ].event == index - 1 && inEventOrder( index + 1 ) );
+    }
+
+    static_assert( hashesToSlot( 0 ), "eventNames has a name in the wrong slot, regenerate it" );
+    static_assert( inEventOrder( 0 ), "canonicalNames must be in InputDeviceEvent::Event order" );
+
+    template<typename Char>
+    InputDeviceEvent::Event lookup( const Char *name, const int length ) {
+
+        if( length == 0 ) {
+            return InputDeviceEvent::Unknown;
+        }
+
+        const EventName &entry = eventNames[ hash( name, length ) ];
+
+        if( entry.length != length ) {
+            return InputDeviceEvent::Unknown;
+        }
+
+        for( int i = 0; i < length; ++i ) {
+            if( code( name[ i ] ) != code( entry.name[ i ] ) ) {
+                return InputDeviceEvent::Unknown;
+            }
+        }
+
+        return entry.event;
 
-QString InputDeviceEvent::toString( const InputDeviceEvent::Event &event ) {
-    switch( event ) {
-        case B:
-            return "b";
-
-        case A:
-            return "a";
-
-        case X:
-            return "x";
-
-        case Y:
-            return "y";
-
-        case Start:
-            return "start";
-
-        case Select:
-            return "back";
-
-        case Up:
-            return "dup";
-
-        case Down:
-            return "dpdown";
-
-        case Left:
-            return "dpleft";
-
-        case Right:
-            return "dpright";
-
-        case L:
-            return "leftshoulder";
-
-        case R:
-            return "rightshoulder";
-
-        case L2:
-            return "lefttrigger";
-
-        case R2:
-            return "righttrigger";
-
-        case L3:
-            return "leftstick";
-
-        case R3:
-            return "rightstick";
-
-        default:
-            return "unknown";
-    }
-}
-
-InputDeviceEvent::Event InputDeviceEvent::toEvent( const QString button ) {
-    if( button == "b" ) {
-        return Event::B;
-    }
-
-    else if( button == "a" ) {
-        return Event::A;
-    }
-
-    else if( button == "x" ) {
-        return Event::X;
     }
 
-    else if( button == "y" ) {
-        return Event::Y;
-    }
-
-    else if( button == "start" ) {
-        return Event::Start;
-    }
-
-    else if( button == "select" ) {
-        return Event::Select;
-    }
-
-    else if( button == "dpup" ) {
-        return Event::Up;
-    }
-
-    else if( button == "dpdown" ) {
-        return Event::Down;
-    }
-
-    else if( button == "dpleft" ) {
-        return Event::Left;
-    }
-
-    else if( button == "dpright" ) {
-        return Event::Right;
-    }
+}
 
-    else if( button == "leftshoulder" ) {
-        return Event::L;
-    }
+QLatin1String InputDeviceEvent::toString( const InputDeviceEvent::Event &event ) {
 
-    else if( button == "rightshoulder" ) {
-        return Event::R;
+    if( event < Guide || event >= Unknown ) {
+        return QLatin1String( "unknown" );
     }
 
-    else if( button == "righttrigger" ) {
-        return Event::R2;
-    }
+    const EventName &entry = canonicalNames[ event + 1 ];
+    return QLatin1String( entry.name, entry.length );
 
-    else if( button == "lefttrigger" ) {
-        return Event::L2;
-    }
-
-    else if( button == "rightstick" ) {
-        return Event::R3;
-    }
+}
 
-    else if( button == "leftstick" ) {
-        return Event::L3;
-    }
+InputDeviceEvent::Event InputDeviceEvent::toEvent( const QString &button ) {
+    return lookup( button.constData(), button.size() );
+}
 
-    return Event::Unknown;
+InputDeviceEvent::Event InputDeviceEvent::toEvent( const QLatin1String &button ) {
+    return lookup( button.data(), button.size() );
 }
@@ -37,9 +37,13 @@ class InputDeviceEvent : public QObject {
 
         Q_ENUMS( Event )
 
-        static QString toString( const InputDeviceEvent::Event &event );
+        // SDL's name for the event ("a", "back", "dpup", "lefttrigger"...), "unknown" if there is none.
+        static QLatin1String toString( const InputDeviceEvent::Event &event );
 
-        static Event toEvent( const QString button );
+        // The reverse of toString(). The names older versions saved, "select" and "dup", are accepted too.
+        // Unknown if the name isn't one of them.
+        static Event toEvent( const QString &button );
+        static Event toEvent( const QLatin1String &button );
 
 };
 
@@ -0,0 +1,37 @@
+#ifndef INPUTEVENT_H
+#define INPUTEVENT_H
+
+#include <QMetaType>
+#include <QVector>
+
+#include <chrono>
+
+#include "inputdeviceevent.h"
+
+// One button or axis change, as delivered to the frontend and the other input consumers. Kept at 16 bytes.
+struct InputEvent {
+
+    // Monotonic nanoseconds
+    static qint64 currentTime() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                   std::chrono::steady_clock::now().time_since_epoch() ).count();
+    }
+
+    // InputDevice::deviceIndex() of the device that sent it
+    qint16 device;
+
+    // InputDeviceEvent::Event, or the raw button number for edit mode events
+    qint16 event;
+
+    int16_t value;
+
+    // When the change was sampled, see currentTime()
+    qint64 timestamp;
+
+};
+
+using InputEventList = QVector<InputEvent>;
+
+Q_DECLARE_METATYPE( InputEventList )
+
+#endif // INPUTEVENT_H
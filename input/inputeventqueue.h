@@ -0,0 +1,106 @@
+#ifndef INPUTEVENTQUEUE_H
+#define INPUTEVENTQUEUE_H
+
+#include <QtGlobal>
+
+#include <atomic>
+
+#include "inputevent.h"
+
+// InputEventQueue is a bounded, lock-free ring of InputEvents with exactly one producer thread and one
+// consumer thread. Every consumer (the QML frontend, the edit mode mapper...) gets its own queue per producer,
+// so pushing an event is a copy and an atomic store, with no allocation and no signal.
+
+// If the consumer falls a whole ring behind, new events are dropped and counted instead of blocking the producer.
+
+// The producer may move to another thread as long as the two never push at the same time, and the old producer's
+// last push happens before the new one's first. Only the Keyboard's queue does that, moving between the GUI thread
+// and the evdevThread under the Keyboard's lock (see Keyboard::setDirectInput()). The joystick queues are fed by
+// the input thread, or by the evdevThread with the evdev backend, and never move.
+
+class InputEventQueue {
+
+    public:
+
+        static const quint32 capacity = 1024;
+
+        InputEventQueue()
+            : head( 0 ),
+              tail( 0 ),
+              overflows( 0 ) {
+        }
+
+        // Producer side. Returns false if the queue was full.
+        bool push( const InputEvent &event ) {
+
+            quint32 currentHead = head.load( std::memory_order_relaxed );
+
+            if( currentHead - tail.load( std::memory_order_acquire ) >= capacity ) {
+                overflows.fetch_add( 1, std::memory_order_relaxed );
+                return false;
+            }
+
+            ring[ currentHead & ( capacity - 1 ) ] = event;
+            head.store( currentHead + 1, std::memory_order_release );
+            return true;
+
+        }
+
+        // Consumer side. Returns false if the queue was empty.
+        bool pop( InputEvent &event ) {
+
+            quint32 currentTail = tail.load( std::memory_order_relaxed );
+
+            if( currentTail == head.load( std::memory_order_acquire ) ) {
+                return false;
+            }
+
+            event = ring[ currentTail & ( capacity - 1 ) ];
+            tail.store( currentTail + 1, std::memory_order_release );
+            return true;
+
+        }
+
+        // Consumer side. Appends everything that's queued to 'events', returns how many were appended.
+        int drain( InputEventList &events ) {
+
+            int count = 0;
+            InputEvent event;
+
+            while( pop( event ) ) {
+                events.append( event );
+                ++count;
+            }
+
+            return count;
+
+        }
+
+        // Safe from either side, but only a hint for the side that isn't the consumer.
+        bool isEmpty() const {
+            return head.load( std::memory_order_acquire ) == tail.load( std::memory_order_acquire );
+        }
+
+        quint64 overflowCount() const {
+            return overflows.load( std::memory_order_relaxed );
+        }
+
+    private:
+
+        // Written by the producer, kept on its own cache line so the two sides don't fight over it
+        std::atomic<quint32> head;
+        char headPadding[ 64 - sizeof( std::atomic<quint32> ) ];
+
+        // Written by the consumer
+        std::atomic<quint32> tail;
+        char tailPadding[ 64 - sizeof( std::atomic<quint32> ) ];
+
+        std::atomic<quint64> overflows;
+
+        InputEvent ring[ capacity ];
+
+        Q_DISABLE_COPY( InputEventQueue )
+
+};
+
+#endif // INPUTEVENTQUEUE_H
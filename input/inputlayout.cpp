@@ -0,0 +1,40 @@
+#include "inputlayout.h"
+
+// The tables are odr-used by translate(), so C++11 needs them defined once.
+constexpr InputLayout::AxisBinding InputLayout::AnalogAxes::axes[];
+constexpr InputLayout::AxisBinding InputLayout::StickAxes::axes[];
+constexpr InputLayout::ButtonBinding InputLayout::SNESButtons::buttons[];
+constexpr InputLayout::ButtonBinding InputLayout::GenesisLayout::buttons[];
+constexpr InputLayout::ButtonBinding InputLayout::N64Layout::buttons[];
+
+InputLayout::Type InputLayout::fromName( const QString &name ) {
+
+    for( Type layout : { Genesis, N64, PlayStation } ) {
+        if( name == InputLayout::name( layout ) ) {
+            return layout;
+        }
+    }
+
+    return SNES;
+
+}
+
+QString InputLayout::name( const Type layout ) {
+
+    switch( layout ) {
+
+        case Genesis:
+            return QStringLiteral( "genesis" );
+
+        case N64:
+            return QStringLiteral( "n64" );
+
+        case PlayStation:
+            return QStringLiteral( "playstation" );
+
+        default:
+            return QStringLiteral( "snes" );
+
+    }
+
+}
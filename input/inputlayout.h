@@ -0,0 +1,198 @@
+#ifndef INPUTLAYOUT_H
+#define INPUTLAYOUT_H
+
+#include <QString>
+
+#include "inputdeviceevent.h"
+#include "inputstate.h"
+#include "joystickstate.h"
+
+// SDL GameControllers report an Xbox 360 layout. A layout is a constexpr table that says which SDL button or axis
+// drives which RETRO_PAD button, so the SDL -> RETRO_PAD translation is a fixed loop of shifts and masks
+// instead of a sequence of hand-written branches. Every layout is its own type, and translate<Layout>() is
+// instantiated per layout, so supporting another layout costs nothing at runtime.
+
+// Layouts only depend on SDL's enums, not on a device, so they can be checked with hand built JoystickStates.
+
+namespace InputLayout {
+
+    enum Type {
+        SNES = 0,
+        Genesis,
+        N64,
+        PlayStation,
+    };
+
+    // Names for the "input/layout" setting: "snes", "genesis", "n64" and "playstation". Anything else is SNES.
+    Type fromName( const QString &name );
+    QString name( const Type layout );
+
+    struct ButtonBinding {
+        int sdlButton;
+
+        // Bit inside of InputState::buttons
+        int bit;
+    };
+
+    struct AxisBinding {
+        int sdlAxis;
+
+        // InputState::Axis slot
+        int slot;
+    };
+
+    constexpr int eventBit( const InputDeviceEvent::Event event ) {
+        return event == InputDeviceEvent::Guide ? InputState::guideBit : static_cast<int>( event );
+    }
+
+    constexpr ButtonBinding bind( const SDL_GameControllerButton button, const InputDeviceEvent::Event event ) {
+        return ButtonBinding { button, eventBit( event ) };
+    }
+
+    // Axes are copied as-is. With every layout, the triggers also press L2 and R2 when they're not at rest.
+    struct AnalogAxes {
+        static constexpr AxisBinding axes[] = {
+            { SDL_CONTROLLER_AXIS_LEFTX, InputState::LeftX },
+            { SDL_CONTROLLER_AXIS_LEFTY, InputState::LeftY },
+            { SDL_CONTROLLER_AXIS_RIGHTX, InputState::RightX },
+            { SDL_CONTROLLER_AXIS_RIGHTY, InputState::RightY },
+            { SDL_CONTROLLER_AXIS_TRIGGERLEFT, InputState::LeftTrigger },
+            { SDL_CONTROLLER_AXIS_TRIGGERRIGHT, InputState::RightTrigger },
+        };
+    };
+
+    // Only the sticks are analog, the triggers are nothing but L2 and R2.
+    struct StickAxes {
+        static constexpr AxisBinding axes[] = {
+            { SDL_CONTROLLER_AXIS_LEFTX, InputState::LeftX },
+            { SDL_CONTROLLER_AXIS_LEFTY, InputState::LeftY },
+            { SDL_CONTROLLER_AXIS_RIGHTX, InputState::RightX },
+            { SDL_CONTROLLER_AXIS_RIGHTY, InputState::RightY },
+        };
+    };
+
+    // The face buttons are matched by position, so Xbox B (right) is RETRO_PAD A (right) and so on.
+    struct SNESButtons {
+        static constexpr ButtonBinding buttons[] = {
+            bind( SDL_CONTROLLER_BUTTON_DPAD_LEFT, InputDeviceEvent::Left ),
+            bind( SDL_CONTROLLER_BUTTON_DPAD_RIGHT, InputDeviceEvent::Right ),
+            bind( SDL_CONTROLLER_BUTTON_DPAD_UP, InputDeviceEvent::Up ),
+            bind( SDL_CONTROLLER_BUTTON_DPAD_DOWN, InputDeviceEvent::Down ),
+
+            bind( SDL_CONTROLLER_BUTTON_START, InputDeviceEvent::Start ),
+            bind( SDL_CONTROLLER_BUTTON_BACK, InputDeviceEvent::Select ),
+            bind( SDL_CONTROLLER_BUTTON_GUIDE, InputDeviceEvent::Guide ),
+
+            bind( SDL_CONTROLLER_BUTTON_B, InputDeviceEvent::A ),
+            bind( SDL_CONTROLLER_BUTTON_A, InputDeviceEvent::B ),
+            bind( SDL_CONTROLLER_BUTTON_Y, InputDeviceEvent::X ),
+            bind( SDL_CONTROLLER_BUTTON_X, InputDeviceEvent::Y ),
+
+            bind( SDL_CONTROLLER_BUTTON_LEFTSTICK, InputDeviceEvent::L3 ),
+            bind( SDL_CONTROLLER_BUTTON_RIGHTSTICK, InputDeviceEvent::R3 ),
+
+            bind( SDL_CONTROLLER_BUTTON_LEFTSHOULDER, InputDeviceEvent::L ),
+            bind( SDL_CONTROLLER_BUTTON_RIGHTSHOULDER, InputDeviceEvent::R ),
+        };
+    };
+
+    struct SNESLayout : SNESButtons, AnalogAxes {
+    };
+
+    // Genesis cores read A, B, C from RETRO_PAD Y, B, A and X, Y, Z from L, X, R. This puts A, B, C on
+    // the bottom row (Xbox X, A, B) and X, Y, Z on the top row (LB, Y, RB).
+    struct GenesisLayout : AnalogAxes {
+        static constexpr ButtonBinding buttons[] = {
+            bind( SDL_CONTROLLER_BUTTON_DPAD_LEFT, InputDeviceEvent::Left ),
+            bind( SDL_CONTROLLER_BUTTON_DPAD_RIGHT, InputDeviceEvent::Right ),
+            bind( SDL_CONTROLLER_BUTTON_DPAD_UP, InputDeviceEvent::Up ),
+            bind( SDL_CONTROLLER_BUTTON_DPAD_DOWN, InputDeviceEvent::Down ),
+
+            bind( SDL_CONTROLLER_BUTTON_START, InputDeviceEvent::Start ),
+            bind( SDL_CONTROLLER_BUTTON_BACK, InputDeviceEvent::Select ),
+            bind( SDL_CONTROLLER_BUTTON_GUIDE, InputDeviceEvent::Guide ),
+
+            bind( SDL_CONTROLLER_BUTTON_X, InputDeviceEvent::Y ),
+            bind( SDL_CONTROLLER_BUTTON_A, InputDeviceEvent::B ),
+            bind( SDL_CONTROLLER_BUTTON_B, InputDeviceEvent::A ),
+
+            bind( SDL_CONTROLLER_BUTTON_LEFTSHOULDER, InputDeviceEvent::L ),
+            bind( SDL_CONTROLLER_BUTTON_Y, InputDeviceEvent::X ),
+            bind( SDL_CONTROLLER_BUTTON_RIGHTSHOULDER, InputDeviceEvent::R ),
+        };
+    };
+
+    // N64 cores read A and B from RETRO_PAD B and Y, Z from L2 and the C buttons from the right stick.
+    // Xbox A and X are already in A and B's spots, and the left trigger drives L2.
+    struct N64Layout : AnalogAxes {
+        static constexpr ButtonBinding buttons[] = {
+            bind( SDL_CONTROLLER_BUTTON_DPAD_LEFT, InputDeviceEvent::Left ),
+            bind( SDL_CONTROLLER_BUTTON_DPAD_RIGHT, InputDeviceEvent::Right ),
+            bind( SDL_CONTROLLER_BUTTON_DPAD_UP, InputDeviceEvent::Up ),
+            bind( SDL_CONTROLLER_BUTTON_DPAD_DOWN, InputDeviceEvent::Down ),
+
+            bind( SDL_CONTROLLER_BUTTON_START, InputDeviceEvent::Start ),
+            bind( SDL_CONTROLLER_BUTTON_GUIDE, InputDeviceEvent::Guide ),
+
+            bind( SDL_CONTROLLER_BUTTON_A, InputDeviceEvent::B ),
+            bind( SDL_CONTROLLER_BUTTON_X, InputDeviceEvent::Y ),
+
+            bind( SDL_CONTROLLER_BUTTON_LEFTSHOULDER, InputDeviceEvent::L ),
+            bind( SDL_CONTROLLER_BUTTON_RIGHTSHOULDER, InputDeviceEvent::R ),
+        };
+    };
+
+    // Sony's face buttons sit where Nintendo's do: Cross, Circle, Square and Triangle are RETRO_PAD B, A, Y and X,
+    // so the SNES buttons apply as they are. A DualShock's L2 and R2 are plain buttons, so the triggers only press
+    // those and the trigger axes stay at rest.
+    struct PlayStationLayout : SNESButtons, StickAxes {
+    };
+
+    // Turns one SDL sample into RETRO_PAD states. The tables are constexpr and fixed size, so the compiler
+    // unrolls both loops into straight-line shifts and masks.
+    template<typename Layout>
+    InputState translate( const JoystickState &pad ) {
+
+        InputState state;
+
+        for( const auto &binding : Layout::buttons ) {
+            state.buttons |= ( ( pad.buttons >> binding.sdlButton ) & 1u ) << binding.bit;
+        }
+
+        for( const auto &binding : Layout::axes ) {
+            state.axes[ binding.slot ] = pad.axes[ binding.sdlAxis ];
+        }
+
+        state.buttons |= static_cast<quint32>( pad.axes[ SDL_CONTROLLER_AXIS_TRIGGERLEFT ] != 0 )
+                         << eventBit( InputDeviceEvent::L2 );
+        state.buttons |= static_cast<quint32>( pad.axes[ SDL_CONTROLLER_AXIS_TRIGGERRIGHT ] != 0 )
+                         << eventBit( InputDeviceEvent::R2 );
+
+        return state;
+
+    }
+
+    // Runtime dispatch to the right instantiation, done once per device per poll.
+    inline InputState translate( const Type layout, const JoystickState &pad ) {
+
+        switch( layout ) {
+
+            case Genesis:
+                return translate<GenesisLayout>( pad );
+
+            case N64:
+                return translate<N64Layout>( pad );
+
+            case PlayStation:
+                return translate<PlayStationLayout>( pad );
+
+            default:
+                return translate<SNESLayout>( pad );
+
+        }
+
+    }
+
+}
+
+#endif // INPUTLAYOUT_H
@@ -1,14 +1,48 @@
 #include "inputmanager.h"
 
+#include "input/profilestore.h"
+
+#include <QGuiApplication>
+#include <QTextStream>
+
 InputManager::InputManager( QObject *parent )
     : QObject( parent ),
       keyboard( new Keyboard() ),
-      sdlEventLoop( this ) {
+      inputThread( this ),
+      sdlEventLoop( new SDLEventLoop ),
+      qmlPollRate( SDLEventLoop::defaultPollRate ),
+      padLayout( InputLayout::SNES ),
+      evdevBackend( false ),
+#ifdef Q_OS_LINUX
+      evdevThread( this ),
+      evdevEventLoop( nullptr ),
+#endif
+      frontendDispatchPending( 0 ),
+      latchedFrameNumber( 0 ) {
+
+    qRegisterMetaType<InputEventList>();
 
     keyboard->loadMapping();
 
-    connect( &sdlEventLoop, &SDLEventLoop::deviceConnected, this, &InputManager::insert );
-    connect( &sdlEventLoop, &SDLEventLoop::deviceRemoved, this, &InputManager::removeAt );
+    // Enough for every queue to be full at once.
+    dispatchedFrontendEvents.reserve( 3 * InputEventQueue::capacity );
+
+    // The Keyboard's edit mode events are emitted straight from the GUI thread already.
+    keyboard->setEventQueues( &keyboardFrontendQueue, nullptr );
+    sdlEventLoop->setEventQueues( &joystickFrontendQueue, &joystickEditModeQueue );
+
+    // The batch is sent once per poll, right from the inputThread. The Keyboard asks on its own, there is
+    // no poll to wait for with evdev.
+    connect( keyboard, &Keyboard::keysInserted, this, &InputManager::requestFrontendDispatch );
+    connect( sdlEventLoop, &SDLEventLoop::polled, this, &InputManager::requestFrontendDispatch, Qt::DirectConnection );
+
+    // These are queued connections, the SDLEventLoop emits them from the inputThread.
+    connect( sdlEventLoop, &SDLEventLoop::deviceConnected, this, &InputManager::insert );
+    connect( sdlEventLoop, &SDLEventLoop::deviceRemoved, this, &InputManager::removeAt );
+
+    // Both live in the GUI thread.
+    qmlFrontendDevice = new QMLInputDevice( this );
+    connect( this, &InputManager::frontendEvents, qmlFrontendDevice, &QMLInputDevice::insertBatch );
 
     // The Keyboard will be always active in port 0,
     // unless changed by the user.
@@ -17,13 +51,102 @@ InputManager::InputManager( QObject *parent )
         deviceList.append( nullptr );
     }
 
-    sdlEventLoop.start();
+    latchedPorts.resize( deviceList.size() );
+
+    QSettings settings;
+    settings.beginGroup( "input" );
+    inputThread.setAffinity( settings.value( "cpuAffinity", -1 ).toInt() );
+    qmlPollRate = settings.value( "pollRate", SDLEventLoop::defaultPollRate ).toInt();
+    padLayout = InputLayout::fromName( settings.value( "layout" ).toString() );
+    QString backend = settings.value( "backend", "sdl" ).toString();
+    QString keyboardSource = settings.value( "keyboard", "qt" ).toString();
+    settings.endGroup();
+
+#ifdef Q_OS_LINUX
+    evdevBackend = ( backend == QStringLiteral( "evdev" ) );
+    bool evdevKeyboard = ( keyboardSource == QStringLiteral( "evdev" ) );
+
+    if( evdevBackend || evdevKeyboard ) {
+        evdevEventLoop = new EvdevEventLoop;
+        evdevEventLoop->setEventQueues( &joystickFrontendQueue, &joystickEditModeQueue );
+        evdevEventLoop->setJoysticksEnabled( evdevBackend );
+
+        // Once a keyboard has been opened, the Keyboard's frontend queue is fed from the evdevThread and the
+        // window's key events are only used in edit mode. Until then, and once the last one is gone, the
+        // window's key events are used as usual.
+        if( evdevKeyboard ) {
+            evdevEventLoop->setKeyboard( keyboard );
+
+            // Keys typed into other windows must not reach the game.
+            if( qGuiApp ) {
+                evdevEventLoop->setKeyboardFocus( qGuiApp->applicationState() == Qt::ApplicationActive );
+
+                connect( qGuiApp, &QGuiApplication::applicationStateChanged, this, [ this ]( Qt::ApplicationState state ) {
+                    evdevEventLoop->setKeyboardFocus( state == Qt::ApplicationActive );
+                } );
+            }
+        }
+
+        connect( evdevEventLoop, &EvdevEventLoop::polled, this, &InputManager::requestFrontendDispatch, Qt::DirectConnection );
+        connect( evdevEventLoop, &EvdevEventLoop::deviceConnected, this, &InputManager::insert );
+        connect( evdevEventLoop, &EvdevEventLoop::deviceRemoved, this, &InputManager::removeAt );
+
+        evdevEventLoop->moveToThread( &evdevThread );
+        evdevThread.setAffinity( inputThread.affinity() );
+        evdevThread.start( QThread::TimeCriticalPriority );
+
+        QMetaObject::invokeMethod( evdevEventLoop, "run", Qt::QueuedConnection );
+    }
+#else
+
+    if( backend != QStringLiteral( "sdl" ) ) {
+        qCWarning( phxInput ) << "Input backend" << backend << "is not available here, using SDL";
+    }
+
+    if( keyboardSource != QStringLiteral( "qt" ) ) {
+        qCWarning( phxInput ) << "Keyboard source" << keyboardSource << "is not available here, using Qt";
+    }
+
+#endif
+
+    sdlEventLoop->setPollRate( qmlPollRate );
+    sdlEventLoop->moveToThread( &inputThread );
+    inputThread.start( QThread::TimeCriticalPriority );
+
+    invokeOnInputThread( "start", false );
 
 }
 
 InputManager::~InputManager() {
 
-    sdlEventLoop.stop();
+    // The timer has to be stopped from the thread it lives in.
+    invokeOnInputThread( "stop", true );
+    inputThread.quit();
+    inputThread.wait();
+
+    delete sdlEventLoop;
+
+#ifdef Q_OS_LINUX
+
+    if( evdevEventLoop ) {
+        evdevEventLoop->stop();
+        evdevThread.quit();
+        evdevThread.wait();
+
+        delete evdevEventLoop;
+    }
+
+#endif
+
+    stopRecording();
+    stopReplay();
+
+    quint64 dropped = joystickFrontendQueue.overflowCount() + keyboardFrontendQueue.overflowCount()
+                      + joystickEditModeQueue.overflowCount();
+
+    if( dropped ) {
+        qCWarning( phxInput ) << dropped << "input events were dropped because the GUI thread fell behind";
+    }
 
     // I can't guarantee that the device won't be deleted by the deviceRemoved() signal.
     // So make sure we check.
@@ -36,6 +159,9 @@ InputManager::~InputManager() {
 
     keyboard->selfDestruct();
 
+    // The mappings saved above are written in the background, make sure they make it.
+    ProfileStore::instance().flush();
+
 }
 
 int InputManager::size() const {
@@ -43,34 +169,303 @@ int InputManager::size() const {
 }
 
 InputDevice *InputManager::at( int index ) {
+
+    {
+        QMutexLocker locker( &recordingMutex );
+
+        if( index < replayDevices.size() ) {
+            return replayDevices.at( index );
+        }
+    }
+
     QMutexLocker locker( &mutex );
     return deviceList.at( index );
+
+}
+
+void InputManager::latchFrame( const quint64 frameNumber ) {
+
+    // Never polls: the inputThread keeps sampling on its timer, and the evdev devices publish as soon as the
+    // kernel reports something. This only reads what they've already published.
+    QMutexLocker locker( &recordingMutex );
+
+    if( replay.isOpen() ) {
+
+        replay.nextFrame();
+
+        for( auto *device : replayDevices ) {
+            device->update();
+        }
+
+    }
+
+    {
+        QMutexLocker deviceLocker( &mutex );
+
+        for( int i = 0; i < latchedPorts.size(); ++i ) {
+            InputDevice *device = i < replayDevices.size() ? replayDevices.at( i ) : deviceList.at( i );
+            PortState &port = latchedPorts[ i ];
+
+            port.connected = device != nullptr;
+            port.state = device ? device->latchState() : InputState();
+            port.pressedSinceLatch = device ? device->takePressedButtons() & ~port.state.buttons : 0;
+        }
+    }
+
+    latchedFrameNumber = frameNumber;
+
+    if( recorder.isRecording() ) {
+
+        // Taps are recorded as held for the frame, which is how the core saw them.
+        for( int i = 0; i < recordedStates.size(); ++i ) {
+            recordedStates[ i ] = latchedPorts.at( i ).state;
+            recordedStates[ i ].buttons = latchedPorts.at( i ).buttons();
+        }
+
+        recorder.record( recordedStates.constData() );
+
+    }
+
 }
 
 void InputManager::pollStates() {
-    sdlEventLoop.pollEvents();
+    latchFrame( latchedFrameNumber + 1 );
+}
+
+quint64 InputManager::latchedFrame() const {
+    return latchedFrameNumber;
+}
+
+int InputManager::portCount() const {
+    return latchedPorts.size();
+}
+
+bool InputManager::startRecording( const QString &path ) {
+
+    QMutexLocker locker( &recordingMutex );
+
+    int ports = qMin( deviceList.size(), InputRecorder::maxPorts );
+
+    if( !recorder.start( path, ports ) ) {
+        return false;
+    }
+
+    recordedStates.fill( InputState(), ports );
+    return true;
+
+}
+
+void InputManager::stopRecording() {
+    QMutexLocker locker( &recordingMutex );
+    recorder.finish();
+}
+
+bool InputManager::startReplay( const QString &path ) {
+
+    stopReplay();
+
+    QMutexLocker locker( &recordingMutex );
+
+    if( !replay.open( path ) ) {
+        return false;
+    }
+
+    for( int port = 0; port < replay.portCount(); ++port ) {
+        replayDevices.append( new InputReplayDevice( &replay, port ) );
+    }
+
+    return true;
+
+}
+
+void InputManager::stopReplay() {
+
+    QMutexLocker locker( &recordingMutex );
+
+    for( auto *device : replayDevices ) {
+        device->deleteLater();
+    }
+
+    replayDevices.clear();
+    replay.close();
 
 }
 
+QMLInputDevice *InputManager::frontendDevice() const {
+    return qmlFrontendDevice;
+}
+
 bool InputManager::gamepadControlsFrontend() const {
-    return InputDevice::gamepadControlsFrontend;
+    return InputDevice::gamepadControlsFrontend.load( std::memory_order_relaxed );
 }
 
 void InputManager::setGamepadControlsFrontend( const bool control ) {
-    InputDevice::gamepadControlsFrontend = control;
+    InputDevice::gamepadControlsFrontend.store( control, std::memory_order_relaxed );
     emit gamepadControlsFrontendChanged();
 }
 
+int InputManager::pollRate() const {
+    return qmlPollRate;
+}
+
+void InputManager::setPollRate( const int rate ) {
+
+    if( rate == qmlPollRate || rate <= 0 ) {
+        return;
+    }
+
+    qmlPollRate = rate;
+
+    QMetaObject::invokeMethod( sdlEventLoop, "setPollRate", Qt::QueuedConnection, Q_ARG( int, rate ) );
+
+    QSettings settings;
+    settings.setValue( "input/pollRate", rate );
+
+    emit pollRateChanged();
+
+}
+
+QString InputManager::layout() const {
+    return InputLayout::name( padLayout );
+}
+
+void InputManager::setLayout( const QString &layout ) {
+
+    InputLayout::Type type = InputLayout::fromName( layout );
+
+    if( type == padLayout ) {
+        return;
+    }
+
+    mutex.lock();
+
+    padLayout = type;
+
+    for( auto *device : deviceList ) {
+        applyLayout( device );
+    }
+
+    mutex.unlock();
+
+    QSettings settings;
+    settings.setValue( "input/layout", InputLayout::name( type ) );
+
+    emit layoutChanged();
+
+}
+
+QVariantMap InputManager::latencyStats() const {
+
+    QVariantMap stats;
+    bool keyboardListed = false;
+
+    for( int i = 0; i < deviceList.size(); ++i ) {
+        InputDevice *device = deviceList.at( i );
+
+        if( device ) {
+            stats.insert( QString( "%1 %2" ).arg( i ).arg( device->name() ), device->latency().toVariantMap() );
+            keyboardListed |= ( device == keyboard );
+        }
+    }
+
+    if( !keyboardListed ) {
+        stats.insert( QString( "- %1" ).arg( keyboard->name() ), keyboard->latency().toVariantMap() );
+    }
+
+    return stats;
+
+}
+
+bool InputManager::dumpLatencyStats( const QString &path ) const {
+
+    QFile file( path );
+
+    if( !file.open( QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Text ) ) {
+        qCWarning( phxInput ) << "Could not write latency stats to" << path << ":" << file.errorString();
+        return false;
+    }
+
+    QTextStream stream( &file );
+    stream << "device,count,p50_us,p99_us,max_us\n";
+
+    QVariantMap stats = latencyStats();
+
+    for( auto it = stats.constBegin(); it != stats.constEnd(); ++it ) {
+        QVariantMap histogram = it.value().toMap();
+        stream << '"' << it.key() << "\","
+               << histogram.value( "count" ).toULongLong() << ','
+               << histogram.value( "p50" ).toDouble() << ','
+               << histogram.value( "p99" ).toDouble() << ','
+               << histogram.value( "max" ).toDouble() << '\n';
+    }
+
+    return stream.status() == QTextStream::Ok;
+
+}
+
+void InputManager::resetLatencyStats() {
+
+    for( auto device : deviceList ) {
+        if( device ) {
+            device->resetLatency();
+        }
+    }
+
+    keyboard->resetLatency();
+    emit latencyStatsChanged();
+
+}
+
+qint64 InputManager::maxPollTickDuration() const {
+    return sdlEventLoop->maxTickDuration();
+}
+
+void InputManager::resetPollTickStats() {
+    sdlEventLoop->resetTickStats();
+}
+
+bool InputManager::verifyConsistency() {
+
+    bool consistent = true;
+
+    // The EvdevEventLoop is blocked in epoll, its slots are checked against the deviceList below.
+    if( !evdevBackend ) {
+        Qt::ConnectionType type = inputThread.isRunning() ? Qt::BlockingQueuedConnection : Qt::DirectConnection;
+        QMetaObject::invokeMethod( sdlEventLoop, "verifyConsistency", type, Q_RETURN_ARG( bool, consistent ) );
+    }
+
+    QMutexLocker locker( &mutex );
+
+    for( int i = 0; i < deviceList.size(); ++i ) {
+
+        InputDevice *device = deviceList.at( i );
+
+        if( !device || device == keyboard ) {
+            continue;
+        }
+
+        if( device->deviceIndex() != i ) {
+            qCWarning( phxInput ) << device->name() << "is in port" << i << "but belongs in" << device->deviceIndex();
+            consistent = false;
+        }
+
+    }
+
+    return consistent;
+
+}
+
 void InputManager::insert( InputDevice *device ) {
 
-    device->loadMapping();
+    // The event loop already loaded the mapping, off of the GUI and poll threads.
     mutex.lock();
-    auto *joystick = static_cast<Joystick *>( device );
 
-    deviceList[ joystick->sdlIndex() ] = joystick;
+    applyLayout( device );
+
+    deviceList[ device->deviceIndex() ] = device;
 
     mutex.unlock();
-    emit deviceAdded( joystick );
+    emit deviceAdded( device );
 
 }
 
@@ -78,7 +473,7 @@ void InputManager::removeAt( int index ) {
 
     mutex.lock();
 
-    auto *device = static_cast<Joystick *>( deviceList.at( index ) );
+    auto *device = deviceList.at( index );
     device->selfDestruct();
 
     deviceList[ index ] = nullptr;
@@ -89,6 +484,9 @@ void InputManager::removeAt( int index ) {
 
     mutex.unlock();
 
+    // Its releases will never come.
+    qmlFrontendDevice->releaseDevice( index );
+
 }
 
 void InputManager::setRun( bool run ) {
@@ -97,9 +495,8 @@ void InputManager::setRun( bool run ) {
 
     setGamepadControlsFrontend( !run );
 
+    // The poll timer keeps running either way, latchFrame() reads the states it publishes.
     if( run ) {
-        sdlEventLoop.stop();
-
         for( auto device : deviceList ) {
             if( device ) {
                 device->setEditMode( false );
@@ -107,12 +504,12 @@ void InputManager::setRun( bool run ) {
         }
     }
 
-    else {
-        sdlEventLoop.start();
-    }
-
     mutex.unlock();
 
+    if( !run ) {
+        emit latencyStatsChanged();
+    }
+
 }
 
 void InputManager::swap( const int index1, const int index2 ) {
@@ -133,3 +530,97 @@ void InputManager::emitConnectedDevices() {
 
 }
 
+void InputManager::attachVirtualJoysticks( const int count ) {
+    QMetaObject::invokeMethod( sdlEventLoop, "attachVirtualJoysticks", Qt::QueuedConnection, Q_ARG( int, count ) );
+}
+
+void InputManager::detachVirtualJoysticks( const int count ) {
+    QMetaObject::invokeMethod( sdlEventLoop, "detachVirtualJoysticks", Qt::QueuedConnection, Q_ARG( int, count ) );
+}
+
+void InputManager::dispatchFrontendEvents() {
+
+    // Cleared before draining: anything pushed after this point either gets drained below or queues
+    // another dispatch.
+    frontendDispatchPending.storeRelease( 0 );
+
+    joystickFrontendQueue.drain( dispatchedFrontendEvents );
+    keyboardFrontendQueue.drain( dispatchedFrontendEvents );
+
+    if( !dispatchedFrontendEvents.isEmpty() ) {
+        emit frontendEvents( dispatchedFrontendEvents );
+
+        // Keeps the capacity for next time.
+        dispatchedFrontendEvents.resize( 0 );
+    }
+
+    InputEvent editModeEvent;
+
+    while( joystickEditModeQueue.pop( editModeEvent ) ) {
+
+        // The device may have been removed since.
+        InputDevice *device = deviceList.value( editModeEvent.device, nullptr );
+
+        if( device && device != keyboard ) {
+            emit device->editModeEvent( editModeEvent.event, editModeEvent.value );
+        }
+
+    }
+
+}
+
+void InputManager::requestFrontendDispatch() {
+
+    if( !hasPendingEvents() ) {
+        return;
+    }
+
+    if( !frontendDispatchPending.testAndSetAcquire( 0, 1 ) ) {
+        return;
+    }
+
+    QMetaObject::invokeMethod( this, "dispatchFrontendEvents", Qt::QueuedConnection );
+
+}
+
+bool InputManager::hasPendingEvents() const {
+    return !joystickFrontendQueue.isEmpty() || !keyboardFrontendQueue.isEmpty() || !joystickEditModeQueue.isEmpty();
+}
+
+void InputManager::applyLayout( InputDevice *device ) const {
+
+    if( auto *joystick = dynamic_cast<Joystick *>( device ) ) {
+        joystick->setLayout( padLayout );
+    }
+
+#ifdef Q_OS_LINUX
+
+    else if( auto *evdevJoystick = dynamic_cast<EvdevJoystick *>( device ) ) {
+        evdevJoystick->setLayout( padLayout );
+    }
+
+#endif
+
+}
+
+void InputManager::invokeOnInputThread( const char *method, const bool wait ) {
+
+    // The SDLEventLoop is never started with evdev, the controllers would show up twice.
+    if( evdevBackend ) {
+        return;
+    }
+
+    // BlockingQueuedConnection deadlocks if we're already in the inputThread.
+    Qt::ConnectionType type = Qt::QueuedConnection;
+
+    if( QThread::currentThread() == &inputThread || !inputThread.isRunning() ) {
+        type = Qt::DirectConnection;
+    }
+
+    else if( wait ) {
+        type = Qt::BlockingQueuedConnection;
+    }
+
+    QMetaObject::invokeMethod( sdlEventLoop, method, type );
+
+}
@@ -7,8 +7,15 @@
 #include <QKeyEvent>
 
 #include "input/sdleventloop.h"
+#include "input/evdeveventloop.h"
+#include "input/inputthread.h"
 #include "input/inputdevice.h"
+#include "input/inputevent.h"
+#include "input/inputeventqueue.h"
+#include "input/inputrecording.h"
+#include "input/portstate.h"
 #include "input/keyboard.h"
+#include "input/qmlinputdevice.h"
 #include "logging.h"
 
 #include <memory>
@@ -18,6 +25,15 @@ class InputManager : public QObject {
 
         Q_PROPERTY( bool gamepadControlsFrontend READ gamepadControlsFrontend
                     WRITE setGamepadControlsFrontend NOTIFY gamepadControlsFrontendChanged )
+        Q_PROPERTY( int pollRate READ pollRate WRITE setPollRate NOTIFY pollRateChanged )
+        Q_PROPERTY( QString layout READ layout WRITE setLayout NOTIFY layoutChanged )
+
+        // Lets any device control the UI, fed from frontendEvents().
+        Q_PROPERTY( QMLInputDevice *frontendDevice READ frontendDevice CONSTANT )
+
+        // Per device input latency, keyed by "<port> <name>". Each value holds count, p50, p99 and max,
+        // in microseconds. Refreshed when a game stops.
+        Q_PROPERTY( QVariantMap latencyStats READ latencyStats NOTIFY latencyStatsChanged )
 
     public:
 
@@ -31,13 +47,67 @@ class InputManager : public QObject {
 
         InputDevice *at( int index );
 
+        // Samples every port at once for frame 'frameNumber'. The core calls this once per frame, right before
+        // it starts asking for input, and then answers every retro_input_state call from port().
+        void latchFrame( const quint64 frameNumber );
+
+        // Latches the frame after the last one.
         void pollStates();
 
+        // Only valid on the thread that calls latchFrame().
+        quint64 latchedFrame() const;
+        int portCount() const;
+
+        const PortState &port( const int index ) const {
+            return latchedPorts.at( index );
+        }
+
+        // retro_input_state, served from the latched ports.
+        int16_t inputState( const unsigned port, const unsigned device, const unsigned index, const unsigned id ) const {
+            return port < static_cast<unsigned>( latchedPorts.size() ) ? latchedPorts.at( port ).value( device, index, id ) : 0;
+        }
+
+        // Records every port's state, once per latchFrame(), until stopRecording(). See InputRecorder.
+        Q_INVOKABLE bool startRecording( const QString &path );
+        Q_INVOKABLE void stopRecording();
+
+        // While a replay runs, at() returns its InputReplayDevices instead of the real controllers. Each
+        // latchFrame() plays one frame, the ports are released once the recording is over.
+        Q_INVOKABLE bool startReplay( const QString &path );
+        Q_INVOKABLE void stopReplay();
+
+        QMLInputDevice *frontendDevice() const;
+
         bool gamepadControlsFrontend() const;
 
         // This is just a wrapper around InputDevice::gamepadControlsFrontend.
         void setGamepadControlsFrontend( const bool control );
 
+        // How often the input thread polls SDL, in Hz. Saved as "input/pollRate".
+        int pollRate() const;
+        void setPollRate( const int rate );
+
+        // Which RETRO_PAD layout every controller uses, by InputLayout::name(). Set it from the core's system before
+        // a game starts, saved as "input/layout".
+        QString layout() const;
+        void setLayout( const QString &layout );
+
+        QVariantMap latencyStats() const;
+
+        // Writes latencyStats() to 'path' as CSV. Returns false if the file couldn't be written.
+        Q_INVOKABLE bool dumpLatencyStats( const QString &path ) const;
+
+        Q_INVOKABLE void resetLatencyStats();
+
+        // Longest SDLEventLoop tick since the last reset, in nanoseconds.
+        qint64 maxPollTickDuration() const;
+        void resetPollTickStats();
+
+        // Checks that the input thread's bookkeeping and the deviceList agree on which controllers are
+        // connected, logging every mismatch. Blocks until the input thread has checked, so queued
+        // insert() and removeAt() calls should be processed first.
+        bool verifyConsistency();
+
     public slots:
 
         // Insert or append an inputDevice to the deviceList.
@@ -55,21 +125,89 @@ class InputManager : public QObject {
         // Iterate through, and expose inputDevices to QML.
         void emitConnectedDevices();
 
+        // Plug in or pull out software controllers, for testing without hardware. See VirtualJoystick.
+        void attachVirtualJoysticks( const int count );
+        void detachVirtualJoysticks( const int count );
+
     signals:
 
         void gamepadControlsFrontendChanged();
+        void pollRateChanged();
+        void layoutChanged();
+        void latencyStatsChanged();
         void device( InputDevice *device );
         void deviceAdded( InputDevice *device );
         void incomingEvent( InputDeviceEvent *event );
 
+        // Every frontend edge of every device (pads and the keyboard) since the last emission, in the order they
+        // happened. At most one of these is queued on the GUI thread at a time, the rest pile into the next one.
+        // Already connected to frontendDevice()'s insertBatch().
+        void frontendEvents( const InputEventList &events );
+
+    private slots:
+
+        void dispatchFrontendEvents();
+
     private:
 
         QMutex mutex;
 
         QList<InputDevice *> deviceList;
 
-        SDLEventLoop sdlEventLoop;
+        QMLInputDevice *qmlFrontendDevice;
+
+        // The SDLEventLoop lives in the inputThread, so it can't have a parent.
+        InputThread inputThread;
+        SDLEventLoop *sdlEventLoop;
+
+        int qmlPollRate;
+        InputLayout::Type padLayout;
+
+        // Set from the "input/backend" setting: "sdl" (the default) or "evdev", Linux only. With evdev the
+        // controllers come from the EvdevEventLoop and the SDLEventLoop is never started.
+        bool evdevBackend;
+
+#ifdef Q_OS_LINUX
+        // Also runs with the SDL backend when "input/keyboard" is "evdev" instead of "qt", to read the keyboards.
+        // Blocks in epoll, so it gets a thread of its own.
+        InputThread evdevThread;
+        EvdevEventLoop *evdevEventLoop;
+#endif
+
+        // One queue per producer and consumer, all drained by dispatchFrontendEvents() on the GUI thread.
+        // Joystick events come from the input thread, or from the evdevThread with the evdev backend. Keyboard events
+        // come from the GUI thread, or from the evdevThread when the Keyboard takes direct input.
+        InputEventQueue joystickFrontendQueue;
+        InputEventQueue keyboardFrontendQueue;
+        InputEventQueue joystickEditModeQueue;
+
+        // Reused by every dispatch, so it never has to grow.
+        InputEventList dispatchedFrontendEvents;
+
+        // Set while a dispatchFrontendEvents() call is queued.
+        QAtomicInt frontendDispatchPending;
+
+        // Runs on the input thread after every poll, and on the GUI thread after every key event.
+        void requestFrontendDispatch();
+
+        bool hasPendingEvents() const;
+
+        // Guards the recorder and the replay, which latchFrame() uses from the core's thread.
+        QMutex recordingMutex;
+        InputRecorder recorder;
+        InputReplay replay;
+        QVector<InputReplayDevice *> replayDevices;
+        QVector<InputState> recordedStates;
+
+        // One entry per port, written by latchFrame() and read by the same thread.
+        QVector<PortState> latchedPorts;
+        quint64 latchedFrameNumber;
+
+        // Gives a Joystick or an EvdevJoystick the padLayout, anything else is left alone.
+        void applyLayout( InputDevice *device ) const;
 
+        // Runs one of the SDLEventLoop's slots in the inputThread. 'wait' blocks until the slot returns.
+        void invokeOnInputThread( const char *method, const bool wait );
 
 };
 
@@ -0,0 +1,408 @@
+#include "inputrecording.h"
+
+#include "logging.h"
+
+#include <cstring>
+#include <zlib.h>
+
+namespace {
+
+    const char recordingMagic[ 8 ] = { 'P', 'H', 'X', 'R', 'E', 'C', '0', '1' };
+
+    struct RecordingHeader {
+        char magic[ 8 ];
+        quint32 ports;
+        quint32 axisCount;
+    };
+
+    // Followed by 'compressedSize' bytes of zlib data that inflate to 'rawSize' bytes holding 'frames' frames.
+    struct ChunkHeader {
+        quint32 frames;
+        quint32 rawSize;
+        quint32 compressedSize;
+    };
+
+    // The largest a single frame can get: the port mask, then a button mask and every axis for every port.
+    const int maxFrameSize = 10 + InputRecorder::maxPorts * ( 5 + InputState::AxisCount * 5 );
+
+    void writeVarint( QByteArray &out, quint64 value ) {
+
+        while( value >= 0x80 ) {
+            out.append( static_cast<char>( ( value & 0x7f ) | 0x80 ) );
+            value >>= 7;
+        }
+
+        out.append( static_cast<char>( value ) );
+
+    }
+
+    bool readVarint( const QByteArray &in, int &position, quint64 &value ) {
+
+        value = 0;
+
+        for( int shift = 0; shift < 64 && position < in.size(); shift += 7 ) {
+            uchar byte = static_cast<uchar>( in.at( position++ ) );
+            value |= static_cast<quint64>( byte & 0x7f ) << shift;
+
+            if( !( byte & 0x80 ) ) {
+                return true;
+            }
+        }
+
+        return false;
+
+    }
+
+    // Small deltas of either sign become small varints.
+    quint32 zigzag( const qint32 value ) {
+        return ( static_cast<quint32>( value ) << 1 ) ^ static_cast<quint32>( value >> 31 );
+    }
+
+    qint32 unzigzag( const quint32 value ) {
+        return static_cast<qint32>( value >> 1 ) ^ -static_cast<qint32>( value & 1 );
+    }
+
+    bool sameState( const InputState &a, const InputState &b ) {
+        return a.buttons == b.buttons && std::memcmp( a.axes, b.axes, sizeof( a.axes ) ) == 0;
+    }
+
+}
+
+//
+// InputRecorder
+//
+
+InputRecorder::InputRecorder()
+    : ports( 0 ),
+      frames( 0 ),
+      rawChunkFrames( 0 ) {
+
+}
+
+InputRecorder::~InputRecorder() {
+    finish();
+}
+
+bool InputRecorder::start( const QString &path, const int ports ) {
+
+    finish();
+
+    if( ports <= 0 || ports > maxPorts ) {
+        qCWarning( phxInput ) << "Can't record" << ports << "ports";
+        return false;
+    }
+
+    file.setFileName( path );
+
+    if( !file.open( QIODevice::WriteOnly | QIODevice::Truncate ) ) {
+        qCWarning( phxInput ) << "Unable to record to" << path << ":" << file.errorString();
+        return false;
+    }
+
+    RecordingHeader header;
+    std::memcpy( header.magic, recordingMagic, sizeof( recordingMagic ) );
+    header.ports = static_cast<quint32>( ports );
+    header.axisCount = InputState::AxisCount;
+
+    file.write( reinterpret_cast<const char *>( &header ), sizeof( header ) );
+
+    this->ports = ports;
+    frames = 0;
+    rawChunkFrames = 0;
+
+    // Every port starts out released, the first frame stores whatever differs from that.
+    previousStates.fill( InputState(), ports );
+
+    // Reserved, so resize( 0 ) keeps the capacity between chunks.
+    rawChunk.reserve( chunkBytes + maxFrameSize );
+    rawChunk.resize( 0 );
+    compressedChunk.reserve( static_cast<int>( compressBound( chunkBytes + maxFrameSize ) ) );
+
+    return true;
+
+}
+
+void InputRecorder::record( const InputState *states ) {
+
+    if( !isRecording() ) {
+        return;
+    }
+
+    quint64 changedPorts = 0;
+
+    for( int port = 0; port < ports; ++port ) {
+        if( !sameState( states[ port ], previousStates.at( port ) ) ) {
+            changedPorts |= Q_UINT64_C( 1 ) << port;
+        }
+    }
+
+    writeVarint( rawChunk, changedPorts );
+
+    for( int port = 0; port < ports; ++port ) {
+
+        if( !( changedPorts & ( Q_UINT64_C( 1 ) << port ) ) ) {
+            continue;
+        }
+
+        const InputState &state = states[ port ];
+        InputState &previous = previousStates[ port ];
+
+        writeVarint( rawChunk, state.buttons ^ previous.buttons );
+
+        for( int axis = 0; axis < InputState::AxisCount; ++axis ) {
+            writeVarint( rawChunk, zigzag( state.axes[ axis ] - previous.axes[ axis ] ) );
+        }
+
+        previous = state;
+
+    }
+
+    ++frames;
+    ++rawChunkFrames;
+
+    if( rawChunkFrames >= chunkFrames || rawChunk.size() >= chunkBytes ) {
+        writeChunk();
+    }
+
+}
+
+void InputRecorder::finish() {
+
+    if( !isRecording() ) {
+        return;
+    }
+
+    writeChunk();
+    file.close();
+
+    qCDebug( phxInput ) << "Recorded" << frames << "frames to" << file.fileName();
+
+}
+
+bool InputRecorder::isRecording() const {
+    return file.isOpen();
+}
+
+quint64 InputRecorder::frameCount() const {
+    return frames;
+}
+
+int InputRecorder::portCount() const {
+    return ports;
+}
+
+void InputRecorder::writeChunk() {
+
+    if( rawChunkFrames == 0 ) {
+        return;
+    }
+
+    uLongf compressedSize = compressBound( static_cast<uLong>( rawChunk.size() ) );
+    compressedChunk.resize( static_cast<int>( compressedSize ) );
+
+    int result = compress2( reinterpret_cast<Bytef *>( compressedChunk.data() ), &compressedSize,
+                            reinterpret_cast<const Bytef *>( rawChunk.constData() ),
+                            static_cast<uLong>( rawChunk.size() ), Z_DEFAULT_COMPRESSION );
+
+    if( result != Z_OK ) {
+        qCWarning( phxInput ) << "Unable to compress a recording chunk, zlib error" << result;
+        file.close();
+        return;
+    }
+
+    ChunkHeader header;
+    header.frames = static_cast<quint32>( rawChunkFrames );
+    header.rawSize = static_cast<quint32>( rawChunk.size() );
+    header.compressedSize = static_cast<quint32>( compressedSize );
+
+    file.write( reinterpret_cast<const char *>( &header ), sizeof( header ) );
+    file.write( compressedChunk.constData(), static_cast<qint64>( compressedSize ) );
+
+    rawChunk.resize( 0 );
+    rawChunkFrames = 0;
+
+}
+
+//
+// InputReplay
+//
+
+InputReplay::InputReplay()
+    : data( nullptr ),
+      dataSize( 0 ),
+      nextChunk( 0 ),
+      chunkPosition( 0 ),
+      chunkFramesLeft( 0 ),
+      ports( 0 ),
+      frames( 0 ) {
+
+}
+
+bool InputReplay::open( const QString &path ) {
+
+    close();
+
+    file.setFileName( path );
+
+    if( !file.open( QIODevice::ReadOnly ) ) {
+        qCWarning( phxInput ) << "Unable to open the recording" << path << ":" << file.errorString();
+        return false;
+    }
+
+    qint64 size = file.size();
+    const uchar *map = size >= static_cast<qint64>( sizeof( RecordingHeader ) ) ? file.map( 0, size ) : nullptr;
+
+    if( map ) {
+
+        RecordingHeader header;
+        std::memcpy( &header, map, sizeof( header ) );
+
+        if( std::memcmp( header.magic, recordingMagic, sizeof( recordingMagic ) ) == 0
+            && header.ports > 0 && header.ports <= static_cast<quint32>( InputRecorder::maxPorts )
+            && header.axisCount == static_cast<quint32>( InputState::AxisCount ) ) {
+
+            data = map;
+            dataSize = size;
+            nextChunk = sizeof( RecordingHeader );
+            ports = static_cast<int>( header.ports );
+            states.fill( InputState(), ports );
+            return true;
+
+        }
+
+    }
+
+    qCWarning( phxInput ) << path << "is not a recording";
+    close();
+    return false;
+
+}
+
+void InputReplay::close() {
+
+    file.close();
+
+    data = nullptr;
+    dataSize = 0;
+    nextChunk = 0;
+    chunk.clear();
+    chunkPosition = 0;
+    chunkFramesLeft = 0;
+    ports = 0;
+    frames = 0;
+    states.clear();
+
+}
+
+bool InputReplay::isOpen() const {
+    return data != nullptr;
+}
+
+int InputReplay::portCount() const {
+    return ports;
+}
+
+quint64 InputReplay::frame() const {
+    return frames;
+}
+
+bool InputReplay::nextFrame() {
+
+    while( chunkFramesLeft == 0 ) {
+        if( !loadChunk() ) {
+            states.fill( InputState() );
+            return false;
+        }
+    }
+
+    quint64 changedPorts = 0;
+    bool valid = readVarint( chunk, chunkPosition, changedPorts );
+
+    for( int port = 0; valid && port < ports; ++port ) {
+
+        if( !( changedPorts & ( Q_UINT64_C( 1 ) << port ) ) ) {
+            continue;
+        }
+
+        InputState &state = states[ port ];
+        quint64 value = 0;
+
+        valid = readVarint( chunk, chunkPosition, value );
+        state.buttons ^= static_cast<quint32>( value );
+
+        for( int axis = 0; valid && axis < InputState::AxisCount; ++axis ) {
+            valid = readVarint( chunk, chunkPosition, value );
+            state.axes[ axis ] = static_cast<int16_t>( state.axes[ axis ] + unzigzag( static_cast<quint32>( value ) ) );
+        }
+
+    }
+
+    if( !valid ) {
+        qCWarning( phxInput ) << "The recording is damaged at frame" << frames << ", stopping the replay";
+        nextChunk = dataSize;
+        chunkFramesLeft = 0;
+        states.fill( InputState() );
+        return false;
+    }
+
+    --chunkFramesLeft;
+    ++frames;
+    return true;
+
+}
+
+const InputState &InputReplay::state( const int port ) const {
+    return states.at( port );
+}
+
+bool InputReplay::loadChunk() {
+
+    if( nextChunk + static_cast<qint64>( sizeof( ChunkHeader ) ) > dataSize ) {
+        return false;
+    }
+
+    ChunkHeader header;
+    std::memcpy( &header, data + nextChunk, sizeof( header ) );
+
+    qint64 start = nextChunk + sizeof( ChunkHeader );
+
+    if( start + header.compressedSize > dataSize
+        || header.rawSize > static_cast<quint32>( InputRecorder::chunkBytes + maxFrameSize ) ) {
+        qCWarning( phxInput ) << "The recording has a damaged chunk at" << nextChunk;
+        nextChunk = dataSize;
+        return false;
+    }
+
+    chunk.resize( static_cast<int>( header.rawSize ) );
+    uLongf rawSize = header.rawSize;
+
+    int result = uncompress( reinterpret_cast<Bytef *>( chunk.data() ), &rawSize, data + start, header.compressedSize );
+
+    if( result != Z_OK || rawSize != header.rawSize ) {
+        qCWarning( phxInput ) << "Unable to decompress the recording chunk at" << nextChunk << ", zlib error" << result;
+        nextChunk = dataSize;
+        return false;
+    }
+
+    nextChunk = start + header.compressedSize;
+    chunkPosition = 0;
+    chunkFramesLeft = header.frames;
+    return true;
+
+}
+
+//
+// InputReplayDevice
+//
+
+InputReplayDevice::InputReplayDevice( const InputReplay *replay, const int port, QObject *parent )
+    : InputDevice( LibretroType::AnalogGamepad, QString( "Replay %1" ).arg( port ), parent ),
+      replay( replay ),
+      port( port ) {
+
+}
+
+void InputReplayDevice::update() {
+    insertState( replay->state( port ), InputEvent::currentTime() );
+    publishStates();
+}
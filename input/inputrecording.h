@@ -0,0 +1,132 @@
+#ifndef INPUTRECORDING_H
+#define INPUTRECORDING_H
+
+#include <QByteArray>
+#include <QFile>
+#include <QString>
+#include <QVector>
+
+#include "inputdevice.h"
+#include "inputstate.h"
+
+// An input recording holds the InputState of every port for every frame of a play session, so the session can
+// be replayed with exact frame alignment.
+
+// Each frame only stores what changed since the frame before: a varint mask of the ports that changed, then
+// for each of those the XOR of its button mask and the zigzag varint delta of each axis. An idle frame is a single
+// byte. Frames are grouped into chunks that are compressed with zlib on their own, so a replay only ever holds
+// one decompressed chunk in memory.
+
+// File layout: a RecordingHeader, then any number of chunks, each a ChunkHeader followed by the compressed frames.
+
+// InputRecorder writes a recording.
+class InputRecorder {
+
+    public:
+
+        // The changed port mask is 64 bits wide.
+        static const int maxPorts = 64;
+
+        // A chunk is compressed and written once it holds this many frames, or this many bytes.
+        static const int chunkFrames = 4096;
+        static const int chunkBytes = 64 * 1024;
+
+        InputRecorder();
+        ~InputRecorder();
+
+        bool start( const QString &path, const int ports );
+
+        // Appends one frame. 'states' holds one InputState per port.
+        void record( const InputState *states );
+
+        // Writes out what's left and closes the file.
+        void finish();
+
+        bool isRecording() const;
+        quint64 frameCount() const;
+        int portCount() const;
+
+    private:
+
+        QFile file;
+        int ports;
+        quint64 frames;
+
+        QVector<InputState> previousStates;
+
+        // The current chunk, before and after compression. Both keep their capacity between chunks.
+        QByteArray rawChunk;
+        QByteArray compressedChunk;
+        int rawChunkFrames;
+
+        void writeChunk();
+
+        Q_DISABLE_COPY( InputRecorder )
+
+};
+
+// InputReplay reads a recording back one frame at a time. The file is memory mapped and only the chunk
+// that's being played is decompressed.
+class InputReplay {
+
+    public:
+
+        InputReplay();
+
+        bool open( const QString &path );
+        void close();
+
+        bool isOpen() const;
+        int portCount() const;
+
+        // How many frames have been played.
+        quint64 frame() const;
+
+        // Decodes the next frame into state(). Returns false once the recording is over, every port
+        // is released then.
+        bool nextFrame();
+
+        const InputState &state( const int port ) const;
+
+    private:
+
+        QFile file;
+        const uchar *data;
+        qint64 dataSize;
+
+        // Where the next chunk starts
+        qint64 nextChunk;
+
+        QByteArray chunk;
+        int chunkPosition;
+        quint32 chunkFramesLeft;
+
+        int ports;
+        quint64 frames;
+        QVector<InputState> states;
+
+        bool loadChunk();
+
+        Q_DISABLE_COPY( InputReplay )
+
+};
+
+// InputReplayDevice plays one port of an InputReplay as if it were a controller.
+class InputReplayDevice : public InputDevice {
+        Q_OBJECT
+
+    public:
+
+        explicit InputReplayDevice( const InputReplay *replay, const int port, QObject *parent = 0 );
+
+        // Publishes the port's state of the replay's current frame, call this after InputReplay::nextFrame().
+        void update();
+
+    private:
+
+        const InputReplay *replay;
+        int port;
+
+};
+
+#endif // INPUTRECORDING_H
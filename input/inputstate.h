@@ -0,0 +1,91 @@
+#ifndef INPUTSTATE_H
+#define INPUTSTATE_H
+
+#include <QtGlobal>
+
+#include "inputdeviceevent.h"
+
+// InputState holds every button and axis of one InputDevice in a small fixed-size block, indexed directly by
+// InputDeviceEvent::Event. A whole port fits in a quarter of a cache line and can be copied or published as a unit.
+
+// Buttons are packed into a bitmask. The triggers are also kept as analog values, and value() returns
+// those for L2 and R2 so analog triggers keep their full range.
+
+struct InputState {
+
+        enum Axis {
+            LeftX = 0,
+            LeftY,
+            RightX,
+            RightY,
+            LeftTrigger,
+            RightTrigger,
+            AxisCount,
+        };
+
+        // The Guide button isn't a RETRO_PAD button, so it gets the top bit.
+        static const int guideBit = 31;
+
+        InputState()
+            : buttons( 0 ),
+              axes() {
+        }
+
+        // Bit index of an event inside of 'buttons', -1 if the event has no bit.
+        static int bit( const InputDeviceEvent::Event &event ) {
+            if( event == InputDeviceEvent::Guide ) {
+                return guideBit;
+            }
+
+            return ( event >= 0 && event < InputDeviceEvent::Unknown ) ? event : -1;
+        }
+
+        // Analog slot of an event, -1 if the event is purely digital.
+        static int axis( const InputDeviceEvent::Event &event ) {
+            switch( event ) {
+                case InputDeviceEvent::L2:
+                    return LeftTrigger;
+
+                case InputDeviceEvent::R2:
+                    return RightTrigger;
+
+                default:
+                    return -1;
+            }
+        }
+
+        static quint32 mask( const InputDeviceEvent::Event &event ) {
+            int index = bit( event );
+            return index < 0 ? 0 : 1u << index;
+        }
+
+        bool isPressed( const InputDeviceEvent::Event &event ) const {
+            return buttons & mask( event );
+        }
+
+        int16_t value( const InputDeviceEvent::Event &event ) const {
+            int slot = axis( event );
+            return slot < 0 ? static_cast<int16_t>( isPressed( event ) ) : axes[ slot ];
+        }
+
+        void insert( const InputDeviceEvent::Event &event, const int16_t state ) {
+            quint32 eventMask = mask( event );
+            buttons = state ? ( buttons | eventMask ) : ( buttons & ~eventMask );
+
+            int slot = axis( event );
+
+            if( slot >= 0 ) {
+                axes[ slot ] = state;
+            }
+        }
+
+        // Bit n set means InputDeviceEvent::Event n is pressed, see bit().
+        quint32 buttons;
+
+        int16_t axes[ AxisCount ];
+
+};
+
+static_assert( sizeof( InputState ) <= 64, "InputState must fit in a single cache line" );
+
+#endif // INPUTSTATE_H
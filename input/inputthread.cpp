@@ -0,0 +1,86 @@
+#include "inputthread.h"
+
+#include "logging.h"
+
+#if defined( Q_OS_LINUX )
+#include <pthread.h>
+#include <sched.h>
+#elif defined( Q_OS_WIN )
+#include <windows.h>
+#endif
+
+InputThread::InputThread( QObject *parent )
+    : QThread( parent ),
+      cpuAffinity( -1 ) {
+    setObjectName( "Input thread" );
+}
+
+int InputThread::affinity() const {
+    return cpuAffinity.load();
+}
+
+void InputThread::setAffinity( const int cpu ) {
+    cpuAffinity.store( cpu );
+}
+
+void InputThread::run() {
+
+    applySchedulingPriority();
+    applyAffinity();
+
+    exec();
+
+}
+
+void InputThread::applyAffinity() {
+
+    int cpu = cpuAffinity.load();
+
+    if( cpu < 0 ) {
+        return;
+    }
+
+#if defined( Q_OS_LINUX )
+
+    cpu_set_t cpuSet;
+    CPU_ZERO( &cpuSet );
+    CPU_SET( cpu, &cpuSet );
+
+    if( pthread_setaffinity_np( pthread_self(), sizeof( cpuSet ), &cpuSet ) != 0 ) {
+        qCWarning( phxInput ) << "Unable to pin the input thread to CPU" << cpu;
+    }
+
+#elif defined( Q_OS_WIN )
+
+    if( cpu >= static_cast<int>( sizeof( DWORD_PTR ) * 8 )
+        || SetThreadAffinityMask( GetCurrentThread(), static_cast<DWORD_PTR>( 1 ) << cpu ) == 0 ) {
+        qCWarning( phxInput ) << "Unable to pin the input thread to CPU" << cpu;
+    }
+
+#else
+
+    qCWarning( phxInput ) << "Input thread CPU affinity is not supported on this platform";
+
+#endif
+
+}
+
+void InputThread::applySchedulingPriority() {
+
+    // QThread::TimeCriticalPriority is a no-op under Linux's default SCHED_OTHER policy,
+    // so ask for the lowest real-time priority instead. Without the right privileges
+    // this fails, and we just stay at whatever priority QThread::start() gave us.
+
+#if defined( Q_OS_LINUX )
+
+    sched_param param;
+    param.sched_priority = sched_get_priority_min( SCHED_FIFO );
+
+    if( pthread_setschedparam( pthread_self(), SCHED_FIFO, &param ) != 0 ) {
+        qCDebug( phxInput ) << "Real-time scheduling unavailable for the input thread, using"
+                            << "the default policy";
+    }
+
+#endif
+
+}
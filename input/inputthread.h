@@ -0,0 +1,38 @@
+#ifndef INPUTTHREAD_H
+#define INPUTTHREAD_H
+
+#include <QThread>
+#include <QAtomicInt>
+
+// InputThread is the thread the SDLEventLoop lives in. It is owned by the InputManager.
+
+// Keeping the poll timer off of the GUI thread means QML layout, painting and the core
+// can't add jitter to the time between two polls. On start, the thread raises its own scheduling
+// priority as far as the OS allows and optionally pins itself to a single CPU core.
+
+class InputThread : public QThread {
+        Q_OBJECT
+
+    public:
+
+        explicit InputThread( QObject *parent = 0 );
+
+        // The CPU core the thread will be pinned to, -1 means no affinity.
+        // This only takes effect the next time the thread is started.
+        int affinity() const;
+        void setAffinity( const int cpu );
+
+    protected:
+
+        void run() override;
+
+    private:
+
+        QAtomicInt cpuAffinity;
+
+        void applyAffinity();
+        void applySchedulingPriority();
+
+};
+
+#endif // INPUTTHREAD_H
@@ -1,5 +1,30 @@
 #include "joystick.h"
 
+#include "profilestore.h"
+
+namespace {
+
+    // The raw state ControllerMapping::read() decodes, straight from SDL. SDL returns 0 for anything out of range.
+    struct SDLRawJoystick {
+
+        SDL_Joystick *joystick;
+
+        quint8 button( const int index ) const {
+            return SDL_JoystickGetButton( joystick, index );
+        }
+
+        quint8 hat( const int index ) const {
+            return SDL_JoystickGetHat( joystick, index );
+        }
+
+        qint16 axis( const int index ) const {
+            return SDL_JoystickGetAxis( joystick, index );
+        }
+
+    };
+
+}
+
 const int Joystick::maxNumOfDevices = 128;
 
 Joystick::Joystick( const int joystickIndex, QObject *parent )
@@ -7,8 +32,10 @@ Joystick::Joystick( const int joystickIndex, QObject *parent )
       qmlSdlIndex( joystickIndex ),
       qmlDeadZone( 12000 ),
       qmlAnalogMode( false ),
-      mSDLButtonVector( SDL_CONTROLLER_BUTTON_MAX, SDL_CONTROLLER_BUTTON_INVALID ),
-      mSDLAxisVector( SDL_CONTROLLER_BUTTON_MAX, SDL_CONTROLLER_BUTTON_INVALID ) {
+      mLayout( InputLayout::SNES ),
+      mappingEdited( false ) {
+
+    mMapping.clear();
 
     device = SDL_GameControllerOpen( joystickIndex );
     setName( SDL_GameControllerName( device ) );
@@ -34,11 +61,16 @@ Joystick::Joystick( const int joystickIndex, QObject *parent )
     // This means that we have to hold the mapping ourselves and do it correctly.
 
     connect( this, &Joystick::resetMappingChanged, this, [ this ] {
-        if( resetMapping() )
+        if( resetMapping() ) {
             loadSDLMapping( sdlDevice() );
+            publishMapping();
+            mappingEdited = false;
+            ProfileStore::instance().remove( qmlGuid.toLatin1() );
+        }
     } );
 
-    loadSDLMapping( sdlDevice() );
+    // Unmapped until the SDLEventLoop hands over the result of resolveMapping().
+    publishMapping();
 
 }
 
@@ -70,6 +102,10 @@ int Joystick::sdlIndex() const {
     return qmlSdlIndex;
 }
 
+int Joystick::deviceIndex() const {
+    return qmlSdlIndex;
+}
+
 qreal Joystick::deadZone() const {
     return qmlDeadZone;
 }
@@ -82,45 +118,27 @@ bool Joystick::digitalTriggers() const {
     return mDigitalTriggers;
 }
 
-quint8 Joystick::getButtonState( const SDL_GameControllerButton &button ) {
+JoystickState Joystick::readAll() {
 
-    if( button >= mSDLButtonVector.size() ) {
-        return 0;
-    }
+    SDLRawJoystick joystick = { sdlJoystick() };
 
-    auto buttonID = mSDLButtonVector.at( button );
+    // One copy per read, so a mapping changed meanwhile is never seen half written.
+    const ControllerMapping mapping = publishedMapping.load();
 
-    return SDL_JoystickGetButton( sdlJoystick(), buttonID );
+    // Every SDL_Joystick* getter takes this lock by itself, holding it across the whole read
+    // makes each of those an uncontended recursive lock.
+#if SDL_VERSION_ATLEAST( 2, 0, 7 )
+    SDL_LockJoysticks();
+#endif
 
-}
+    JoystickState state = mapping.read( joystick, mDigitalTriggers );
 
-qint16 Joystick::getAxisState( const SDL_GameControllerAxis &axis ) {
+#if SDL_VERSION_ATLEAST( 2, 0, 7 )
+    SDL_UnlockJoysticks();
+#endif
 
-    if( axis >= mSDLAxisVector.size() ) {
-        return 0;
-    }
+    return state;
 
-    auto axisID = mSDLAxisVector.at( axis );
-
-    switch( axis ) {
-
-        case SDL_CONTROLLER_AXIS_TRIGGERLEFT:
-        case SDL_CONTROLLER_AXIS_TRIGGERRIGHT:
-            if( digitalTriggers() ) {
-                return SDL_JoystickGetButton( sdlJoystick(), axisID );
-            }
-
-            return SDL_JoystickGetAxis( sdlJoystick(),  axisID );
-
-        default:
-            return SDL_JoystickGetAxis( sdlJoystick(),  axisID );
-
-    }
-
-}
-
-QHash<QString, int> &Joystick::sdlMapping() {
-    return sdlControllerMapping;
 }
 
 void Joystick::setAnalogMode( const bool mode ) {
@@ -143,6 +161,14 @@ void Joystick::setSDLIndex( const int index ) {
     qmlSdlIndex = index;
 }
 
+InputLayout::Type Joystick::layout() const {
+    return mLayout.load( std::memory_order_relaxed );
+}
+
+void Joystick::setLayout( const InputLayout::Type layout ) {
+    mLayout.store( layout, std::memory_order_relaxed );
+}
+
 void Joystick::close() {
     Q_ASSERT_X( device, "InputDevice" , "the device was deleted by an external source" );
     SDL_GameControllerClose( device );
@@ -150,70 +176,59 @@ void Joystick::close() {
 
 bool Joystick::loadMapping() {
 
-    return false;
+    if( !lookUpProfile( qmlGuid, mMapping ) ) {
+        return false;
+    }
 
-    /*
-        QSettings settings;
-        settings.beginGroup( guid() );
+    publishMapping();
+    mappingEdited = true;
 
-        // No point in iterating if the file doesn't exist.
-        if ( !QFile::exists( settings.fileName() ) )
-            return false;
+    return true;
 
-        // Check for button saves.
-        for ( int i=0; i < SDL_CONTROLLER_BUTTON_MAX; ++i ) {
-            auto button = static_cast<SDL_GameControllerButton>( i );
+}
 
-            auto buttonString = QString( SDL_GameControllerGetStringForButton( button ) );
+Joystick::ResolvedMapping Joystick::resolveMapping( const QString &guid, const QByteArray &sdlMapping ) {
 
-            auto value = settings.value( buttonString );
+    ResolvedMapping resolved;
+    resolved.edited = lookUpProfile( guid, resolved.mapping );
 
-            if ( value.isValid() ) {
-                int numberValue = value.toInt();
+    if( !resolved.edited ) {
+        lookUpSDLMapping( SDL_JoystickGetGUIDFromString( guid.toLatin1().constData() ), sdlMapping, resolved.mapping );
+    }
 
-                auto event = sdlStringToEvent( buttonString );
+    return resolved;
 
-                if ( event != InputDeviceEvent::Unknown) {
-                    mapping().insert( buttonString, event );
-                    sdlControllerMapping.insert( buttonString, numberValue );
-                    //qDebug() << buttonString << numberValue;
-                }
-            }
-        }
+}
 
-        // Check for axis saves.
-        for ( int i=0; i < SDL_CONTROLLER_AXIS_MAX; ++i ) {
-            auto axis = static_cast<SDL_GameControllerAxis>( i );
+void Joystick::setResolvedMapping( const ResolvedMapping &resolved ) {
+    mMapping = resolved.mapping;
+    mappingEdited = resolved.edited;
+    publishMapping();
+}
 
-            auto axisString = QString( SDL_GameControllerGetStringForAxis( axis ) );
+QByteArray Joystick::sdlMappingString() const {
 
-            auto value = settings.value( axisString );
-            if ( value.isValid() ) {
-                int numberValue = value.toInt();
+    char *mappingString = SDL_GameControllerMapping( device );
 
-                auto event = sdlStringToEvent( axisString );
-                if ( event != InputDeviceEvent::Unknown) {
-                    mapping().insert( axisString, event );
-                    sdlControllerMapping.insert( axisString, numberValue );
-                }
-            }
-        }
+    if( !mappingString ) {
+        return QByteArray();
+    }
 
-        return !mapping().isEmpty();
-        */
+    QByteArray mapping( mappingString );
+    SDL_free( mappingString );
+    return mapping;
 
 }
 
 void Joystick::saveMapping() {
 
-}
+    // Nothing to save while the ControllerDB's mapping is used as is, it could be updated later on.
+    if( !mappingEdited ) {
+        return;
+    }
 
-void Joystick::emitEditModeEvent( int event, int state ) {
-    emit editModeEvent( event, state );
-}
+    ProfileStore::instance().save( qmlGuid.toLatin1(), mMapping.toProfile() );
 
-void Joystick::emitInputDeviceEvent( InputDeviceEvent::Event event, int state ) {
-    emit inputDeviceEvent( event, state );
 }
 
 bool Joystick::hasDigitalTriggers( const QString &guid ) {
@@ -227,95 +242,88 @@ bool Joystick::hasDigitalTriggers( const QString &guid ) {
 }
 
 void Joystick::setMapping( const QVariantMap newMapping ) {
-    Q_UNUSED( newMapping );
 
-    /*
-    for ( auto &newEvent : newMapping.keys() ) {
-        auto newValue = newMapping.value( newEvent ).toInt();
+    // SDL button and axis names to raw joystick button and axis indices, like in an SDL mapping string.
+    for( auto it = newMapping.constBegin(); it != newMapping.constEnd(); ++it ) {
 
-        bool foundCollision = false;
-        for ( auto &oldEvent : sdlControllerMapping.keys() ) {
-            auto oldValue = sdlControllerMapping.value( oldEvent );
+        QByteArray sdlName = it.key().toLatin1();
 
-            // Override old value.
-            if ( newEvent == oldEvent) {
+        // Negative means unmapped.
+        int index = qMax( it.value().toInt(), -1 );
 
-                foundCollision = true;
+        SDL_GameControllerButton button = SDL_GameControllerGetButtonFromString( sdlName.constData() );
 
-                // button collisions will have to be noticed by the user for the time being.
-                // This is because the InputDeviceEvent is <QString, int> instead
-                // of <QString, QString>.
-                qDebug() << name() << newEvent << ":" << oldValue  << "==>" << newValue;
-                //sdlControllerMapping[ newEvent ] = newValue;
-                break;
+        if( button != SDL_CONTROLLER_BUTTON_INVALID ) {
+
+            if( index >= qmlButtonCount ) {
+                qCWarning( phxInput ) << name() << ": no button" << index << "for" << it.key() << ", binding ignored";
+                continue;
             }
-        }
 
-        if ( !foundCollision ) {
-            //sdlControllerMapping.insert( newEvent, newValue );
+            mMapping.buttons[ button ] = static_cast<qint16>( index );
+            mMapping.hats[ button ] = -1;
+            continue;
         }
 
-    }
-    */
-
-}
+        SDL_GameControllerAxis axis = SDL_GameControllerGetAxisFromString( sdlName.constData() );
 
-void Joystick::loadSDLMapping( SDL_GameController *device ) {
+        if( axis != SDL_CONTROLLER_AXIS_INVALID ) {
 
-    // Handle populating our own mappings, because SDL2 often uses the incorrect mapping array.
+            // readAxis() reads digital triggers as buttons.
+            bool trigger = axis == SDL_CONTROLLER_AXIS_TRIGGERLEFT || axis == SDL_CONTROLLER_AXIS_TRIGGERRIGHT;
 
-    QString mappingString = SDL_GameControllerMapping( device );
+            if( index >= ( mDigitalTriggers && trigger ? qmlButtonCount : qmlAxisCount ) ) {
+                qCWarning( phxInput ) << name() << ": no axis" << index << "for" << it.key() << ", binding ignored";
+                continue;
+            }
 
-    auto strList = mappingString.split( "," );
+            mMapping.axes[ axis ] = static_cast<qint16>( index );
+            mMapping.buttonAxisMask &= ~( 1u << axis );
+            continue;
+        }
 
-    for( QString &str : strList ) {
+        qCWarning( phxInput ) << name() << ": unknown button" << it.key() << ", binding ignored";
 
-        auto keyValuePair = str.split( ":" );
+    }
 
-        if( keyValuePair.size() <= 1 ) {
-            continue;
-        }
+    publishMapping();
+    mappingEdited = true;
+    saveMapping();
 
-        auto key = keyValuePair.at( 0 );
-        auto value = keyValuePair.at( 1 );
+}
 
-        if( value.isEmpty() ) {
-            qCWarning( phxInput ) << "The value for " << key << " is empty.";
-            continue;
-        }
+void Joystick::publishMapping() {
+    publishedMapping.store( mMapping );
+}
 
-        if( key == "platform" ) {
-            continue;
-        }
+void Joystick::loadSDLMapping( SDL_GameController *device ) {
+    lookUpSDLMapping( SDL_JoystickGetGUID( SDL_GameControllerGetJoystick( device ) ), sdlMappingString(), mMapping );
+}
 
-        auto prefix = value.at( 0 );
-        int numberValue = value.remove( prefix ).toInt();
-        auto byteArray = key.toLocal8Bit();
-
-        if( key == "leftx"
-            || key == "lefty"
-            || key == "rightx"
-            || key == "righty"
-            || key == "lefttrigger"
-            || key == "righttrigger" ) {
-            mSDLAxisVector[ SDL_GameControllerGetAxisFromString( byteArray.constData() ) ] = numberValue;
-        }
+bool Joystick::lookUpProfile( const QString &guid, ControllerMapping &mapping ) {
 
-        else {
+    // A profile replaces the ControllerDB's mapping as a whole. One saved by another version is ignored.
+    return mapping.fromProfile( ProfileStore::instance().find( guid.toLatin1() ) );
 
-            if( prefix == 'a' ) {
+}
 
-                qCWarning( phxInput ) << key
-                                      << " has an unhandled axis value. Report this to the Phoenix "
-                                      << " developers.";
-                continue;
+void Joystick::lookUpSDLMapping( const SDL_JoystickGUID &guid, const QByteArray &sdlMapping, ControllerMapping &mapping ) {
 
-            }
+    // Handle populating our own mappings, because SDL2 often uses the incorrect mapping array.
 
-            mSDLButtonVector[ SDL_GameControllerGetButtonFromString( byteArray.constData() ) ] = numberValue;
+    auto *entry = ControllerDB::instance().find( guid );
 
-        }
+    if( entry ) {
+        mapping = entry->mapping;
+        return;
+    }
 
+    // Not in our database, so SDL has a built-in mapping for it. Resolve that one by hand.
+    if( sdlMapping.isEmpty() ) {
+        mapping.clear();
+        return;
     }
 
+    ControllerDB::parseMapping( sdlMapping, mapping );
+
 }
@@ -6,9 +6,14 @@
 #include <QVector>
 
 #include "input/inputdevice.h"
+#include "input/controllerdb.h"
+#include "input/inputlayout.h"
+#include "input/joystickstate.h"
+#include "input/seqlock.h"
 #include "libretro.h"
 #include "SDL.h"
 #include "SDL_gamecontroller.h"
+
 class Joystick : public InputDevice {
 
     public:
@@ -25,21 +30,27 @@ class Joystick : public InputDevice {
         int hatCount() const;
         int axisCount() const;
         int sdlIndex() const;
+
+        // Same as sdlIndex()
+        int deviceIndex() const override;
         qreal deadZone() const;
         bool analogMode() const;
         bool digitalTriggers() const;
-        quint8 getButtonState( const SDL_GameControllerButton &button );
 
-        qint16 getAxisState( const SDL_GameControllerAxis &axis );
+        // Reads every mapped button, hat and axis in one pass while holding SDL's joystick lock once.
+        // The bindings come from the ControllerDB, or from SDL's own mapping if the GUID isn't in it.
+        JoystickState readAll();
 
         SDL_GameController *sdlDevice() const;
         SDL_Joystick *sdlJoystick() const;
         SDL_JoystickID instanceID() const;
 
-        QHash< QString, int > &sdlMapping();
-
         void setSDLIndex( const int index );
 
+        // Which RETRO_PAD layout the SDL buttons are translated to, see InputLayout. Set from any thread.
+        InputLayout::Type layout() const;
+        void setLayout( const InputLayout::Type layout );
+
         // This value will be set to 'true' if the
         // core detects a libretro core that
         // can use the analog sticks.
@@ -55,8 +66,18 @@ class Joystick : public InputDevice {
         bool loadMapping() override;
         void saveMapping() override;
 
-        void emitEditModeEvent( int event, int state );
-        void emitInputDeviceEvent( InputDeviceEvent::Event event, int state );
+        // What a new Joystick's mapping resolves to: the user's profile if there is one, else the ControllerDB's
+        // entry, else 'sdlMapping'. Only looks at the GUID, so it can run on any thread.
+        struct ResolvedMapping {
+            ControllerMapping mapping;
+            bool edited;
+        };
+
+        static ResolvedMapping resolveMapping( const QString &guid, const QByteArray &sdlMapping );
+        void setResolvedMapping( const ResolvedMapping &resolved );
+
+        // SDL's built in mapping line for the device, empty if it has none. Call this from SDL's thread.
+        QByteArray sdlMappingString() const;
 
     public slots:
 
@@ -76,19 +97,29 @@ class Joystick : public InputDevice {
         int qmlBallCount;
         qreal qmlDeadZone;
         bool qmlAnalogMode;
+        std::atomic<InputLayout::Type> mLayout;
 
         // Normal variables
         bool mDigitalTriggers;
 
-        // Store button and axis values;
-        QVector<int> mSDLButtonVector;
-        QVector<int> mSDLAxisVector;
+        // Where each SDL button and axis is read from. Only the thread that owns the Joystick touches mMapping,
+        // every change is then published as a whole to readAll(), which runs on the input thread.
+        ControllerMapping mMapping;
+        SeqLock<ControllerMapping> publishedMapping;
+        void publishMapping();
+
+        // Set once mMapping is the user's own, see ProfileStore.
+        bool mappingEdited;
 
         SDL_GameController *device;
-        QHash<QString, int> sdlControllerMapping;
 
         void loadSDLMapping( SDL_GameController *device );
 
+        // lookUpProfile() returns false, and leaves 'mapping' alone, if the GUID has no profile.
+        static bool lookUpProfile( const QString &guid, ControllerMapping &mapping );
+        static void lookUpSDLMapping( const SDL_JoystickGUID &guid, const QByteArray &sdlMapping,
+                                      ControllerMapping &mapping );
+
         bool hasDigitalTriggers( const QString &guid );
 
 };
@@ -0,0 +1,34 @@
+#ifndef JOYSTICKSTATE_H
+#define JOYSTICKSTATE_H
+
+#include <QtGlobal>
+
+#include "SDL_gamecontroller.h"
+
+static_assert( SDL_CONTROLLER_BUTTON_MAX <= 32, "JoystickState::buttons can't hold every SDL button" );
+
+// One sample of every mapped button, hat and axis of a Joystick, in SDL GameController terms.
+// This only needs SDL's enums, so it can be built by hand without a device.
+struct JoystickState {
+
+    JoystickState()
+        : buttons( 0 ),
+          axes() {
+    }
+
+    bool isPressed( const SDL_GameControllerButton &button ) const {
+        return buttons & ( 1u << button );
+    }
+
+    qint16 axis( const SDL_GameControllerAxis &axis ) const {
+        return axes[ axis ];
+    }
+
+    // Bit n is set when SDL_GameControllerButton n is pressed
+    quint32 buttons;
+
+    qint16 axes[ SDL_CONTROLLER_AXIS_MAX ];
+
+};
+
+#endif // JOYSTICKSTATE_H
@@ -1,13 +1,29 @@
 #include "keyboard.h"
 
+#include "profilestore.h"
+
+#include <QVector>
+
+namespace {
+
+    // A Keyboard profile in the ProfileStore is an array of these.
+    struct KeyBinding {
+        qint32 key;
+        qint32 event;
+    };
+
+}
+
 Keyboard::Keyboard( QObject *parent )
-    : InputDevice( LibretroType::DigitalGamepad, "Keyboard", parent ) {
+    : InputDevice( LibretroType::DigitalGamepad, "Keyboard", parent ),
+      direct( false ) {
 
     connect( this, &Keyboard::resetMappingChanged, this, [ this ] {
 
         if( resetMapping() ) {
-            mapping().clear();
+            deviceMapping.clear();
             loadDefaultMapping();
+            saveMapping();
         }
 
     } );
@@ -16,22 +32,24 @@ Keyboard::Keyboard( QObject *parent )
 
 void Keyboard::loadDefaultMapping() {
 
-    mapping().insert( Qt::Key_A, InputDeviceEvent::A );
-    mapping().insert( Qt::Key_D, InputDeviceEvent::B );
-    mapping().insert( Qt::Key_W, InputDeviceEvent::Y );
-    mapping().insert( Qt::Key_S, InputDeviceEvent::X );
-    mapping().insert( Qt::Key_Up , InputDeviceEvent::Up );
-    mapping().insert( Qt::Key_Down, InputDeviceEvent::Down );
-    mapping().insert( Qt::Key_Right, InputDeviceEvent::Right );
-    mapping().insert( Qt::Key_Left, InputDeviceEvent::Left );
-    mapping().insert( Qt::Key_Space, InputDeviceEvent::Select );
-    mapping().insert( Qt::Key_Return, InputDeviceEvent::Start );
-    mapping().insert( Qt::Key_Z, InputDeviceEvent::L );
-    mapping().insert( Qt::Key_X, InputDeviceEvent::R );
-    mapping().insert( Qt::Key_P, InputDeviceEvent::L2 );
-    mapping().insert( Qt::Key_Shift, InputDeviceEvent::R2 );
-    mapping().insert( Qt::Key_N, InputDeviceEvent::L3 );
-    mapping().insert( Qt::Key_M, InputDeviceEvent::R3 );
+    deviceMapping.insert( Qt::Key_A, InputDeviceEvent::A );
+    deviceMapping.insert( Qt::Key_D, InputDeviceEvent::B );
+    deviceMapping.insert( Qt::Key_W, InputDeviceEvent::Y );
+    deviceMapping.insert( Qt::Key_S, InputDeviceEvent::X );
+    deviceMapping.insert( Qt::Key_Up , InputDeviceEvent::Up );
+    deviceMapping.insert( Qt::Key_Down, InputDeviceEvent::Down );
+    deviceMapping.insert( Qt::Key_Right, InputDeviceEvent::Right );
+    deviceMapping.insert( Qt::Key_Left, InputDeviceEvent::Left );
+    deviceMapping.insert( Qt::Key_Space, InputDeviceEvent::Select );
+    deviceMapping.insert( Qt::Key_Return, InputDeviceEvent::Start );
+    deviceMapping.insert( Qt::Key_Z, InputDeviceEvent::L );
+    deviceMapping.insert( Qt::Key_X, InputDeviceEvent::R );
+    deviceMapping.insert( Qt::Key_P, InputDeviceEvent::L2 );
+    deviceMapping.insert( Qt::Key_Shift, InputDeviceEvent::R2 );
+    deviceMapping.insert( Qt::Key_N, InputDeviceEvent::L3 );
+    deviceMapping.insert( Qt::Key_M, InputDeviceEvent::R3 );
+
+    compileMapping();
 
 }
 
@@ -42,53 +60,124 @@ void Keyboard::insert( const int &event, int16_t pressed ) {
         return;
     }
 
-    InputDeviceEvent::Event newEvent = mapping().value( event, InputDeviceEvent::Unknown );
+    // Only the GUI thread changes the keyTable, no need to lock here.
+    quint32 buttons = keyTable.lookup( event );
+
+    if( !buttons ) {
+        return;
+    }
+
+    {
+        QMutexLocker locker( &sourceMutex );
 
-    if( newEvent != InputDeviceEvent::Unknown ) {
-        InputDevice::insert( newEvent, pressed );
+        if( direct.load( std::memory_order_relaxed ) ) {
+            return;
+        }
+
+        insertButtons( buttons, pressed, InputEvent::currentTime() );
     }
 
+    emit keysInserted();
+
 }
 
-InputDeviceMapping &Keyboard::mapping() {
-    return deviceMapping;
+void Keyboard::setDirectInput( const bool directInput ) {
+
+    // Waits for the other source to finish its insert, from here on only the new one gets through.
+    QMutexLocker locker( &sourceMutex );
+    direct.store( directInput, std::memory_order_relaxed );
+
 }
 
-void Keyboard::setMapping( const QVariantMap newMapping ) {
-    Q_UNUSED( newMapping );
+bool Keyboard::directInput() const {
+    return direct.load( std::memory_order_relaxed );
+}
+
+void Keyboard::insertKey( const int key, const int16_t pressed, const qint64 time ) {
+
+    // The window's key events take care of edit mode.
+    if( editMode() ) {
+        return;
+    }
 
-    /*
-    for ( auto &newKey : newMapping.keys() ) {
-        auto newValue = newMapping.value( newKey ).toInt();
+    quint32 buttons;
+
+    {
+        QMutexLocker locker( &mappingMutex );
+        buttons = keyTable.lookup( key );
+    }
 
-        bool foundCollision = false;
-        for ( auto &oldKey : mapping().keys() ) {
-            auto oldValue = InputDeviceEvent::toString( mapping().value( oldKey ) );
+    if( !buttons ) {
+        return;
+    }
 
+    QMutexLocker locker( &sourceMutex );
 
-            if ( oldValue == newKey ) {
-                foundCollision = true;
-                qDebug() << name() << oldValue  << newKey  << ":" << oldKey << "==>" << QString::number( newValue );
+    // The window took over already
+    if( !direct.load( std::memory_order_relaxed ) ) {
+        return;
+    }
 
-                mapping().remove( oldKey );
-                mapping().insert( QString::number( newValue ), InputDeviceEvent::toEvent( newKey ) );
-                break;
-            }
+    insertButtons( buttons, pressed, time );
+
+}
+
+const InputDeviceMapping &Keyboard::mapping() const {
+    return deviceMapping;
+}
+
+void Keyboard::setKeyMapping( const InputDeviceMapping &mapping ) {
+    deviceMapping = mapping;
+    compileMapping();
+}
+
+void Keyboard::setMapping( const QVariantMap newMapping ) {
+
+    // Event names to keys, like the settings file. Each event named is rebound to that one key, every other
+    // binding stays the same.
+    for( auto it = newMapping.constBegin(); it != newMapping.constEnd(); ++it ) {
+
+        auto event = InputDeviceEvent::toEvent( it.key() );
+
+        if( event == InputDeviceEvent::Unknown ) {
+            qCWarning( phxInput ) << name() << ": unknown event" << it.key() << ", binding ignored";
+            continue;
         }
 
-        if ( !foundCollision ) {
-            qDebug() << "no collision " << QString::number( newValue ) << mapping()[ newV ];
-            mapping().insert( QString::number( newValue ), InputDeviceEvent::toEvent( newKey )  );
+        for( auto binding = deviceMapping.begin(); binding != deviceMapping.end(); ) {
+            binding = ( binding.value() == event ) ? deviceMapping.erase( binding ) : binding + 1;
         }
 
+        deviceMapping.insert( it.value().toInt(), event );
+
     }
-    */
-    // To do...
+
+    compileMapping();
+    saveMapping();
 
 }
 
 bool Keyboard::loadMapping() {
 
+    QByteArray profile = ProfileStore::instance().find( name().toUtf8() );
+
+    if( !profile.isEmpty() && profile.size() % sizeof( KeyBinding ) == 0 ) {
+
+        auto *bindings = reinterpret_cast<const KeyBinding *>( profile.constData() );
+        int count = profile.size() / static_cast<int>( sizeof( KeyBinding ) );
+
+        for( int i = 0; i < count; ++i ) {
+            if( bindings[ i ].event >= InputDeviceEvent::Guide && bindings[ i ].event < InputDeviceEvent::Unknown ) {
+                deviceMapping.insert( bindings[ i ].key, static_cast<InputDeviceEvent::Event>( bindings[ i ].event ) );
+            }
+        }
+
+        compileMapping();
+        return !deviceMapping.isEmpty();
+
+    }
+
+    // Older versions saved the mapping in the settings file, move it over to the ProfileStore.
     QSettings settings;
 
     if( !QFile::exists( settings.fileName() ) ) {
@@ -97,33 +186,79 @@ bool Keyboard::loadMapping() {
 
     settings.beginGroup( name() );
 
-    for( int i = 0; i < InputDeviceEvent::Unknown; ++i ) {
+    // Walking the saved names instead of the events also picks up the ones older versions wrote.
+    for( const QString &eventString : settings.childKeys() ) {
 
-        auto event = static_cast<InputDeviceEvent::Event>( i );
-        auto eventString = InputDeviceEvent::toString( event );
+        auto event = InputDeviceEvent::toEvent( eventString );
 
-        auto key = settings.value( eventString );
-
-        if( key.isValid() ) {
-            mapping().insert( key.toInt(), event );
+        if( event != InputDeviceEvent::Unknown ) {
+            deviceMapping.insert( settings.value( eventString ).toInt(), event );
         }
 
     }
 
-    return !mapping().isEmpty();
+    settings.endGroup();
+
+    compileMapping();
+
+    if( deviceMapping.isEmpty() ) {
+        return false;
+    }
+
+    saveMapping();
+    settings.remove( name() );
+
+    return true;
 
 }
 
 void Keyboard::saveMapping() {
 
-    QSettings settings;
-    settings.beginGroup( name() );
+    QVector<KeyBinding> bindings;
+    bindings.reserve( deviceMapping.size() );
+
+    for( auto it = deviceMapping.constBegin(); it != deviceMapping.constEnd(); ++it ) {
+        bindings.append( { it.key(), it.value() } );
+    }
+
+    // Written in the background, this returns right away.
+    ProfileStore::instance().save( name().toUtf8(), QByteArray( reinterpret_cast<const char *>( bindings.constData() ),
+                                                                bindings.size() * static_cast<int>( sizeof( KeyBinding ) ) ) );
+
+}
+
+//
+// Private
+//
+
+void Keyboard::compileMapping() {
+
+    KeyTable table;
+
+    for( auto it = deviceMapping.constBegin(); it != deviceMapping.constEnd(); ++it ) {
+        table.entry( it.key() ) |= InputState::mask( it.value() );
+    }
+
+    QMutexLocker locker( &mappingMutex );
+    keyTable = table;
+
+}
+
+void Keyboard::insertButtons( const quint32 buttons, const int16_t pressed, const qint64 time ) {
+
+    InputState state = deviceStates;
+    state.buttons = pressed ? ( state.buttons | buttons ) : ( state.buttons & ~buttons );
+
+    // The triggers are analog too, see InputState.
+    if( buttons & InputState::mask( InputDeviceEvent::L2 ) ) {
+        state.axes[ InputState::LeftTrigger ] = pressed;
+    }
 
-    for( auto &key : mapping().keys() ) {
-        auto value = mapping().value( key );
-        settings.setValue( InputDeviceEvent::toString( value ), key );
+    if( buttons & InputState::mask( InputDeviceEvent::R2 ) ) {
+        state.axes[ InputState::RightTrigger ] = pressed;
     }
 
-    qDebug() << settings.fileName();
+    insertState( state, time );
+    publishStates();
 
 }
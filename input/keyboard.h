@@ -1,6 +1,8 @@
 #ifndef KEYBOARD_H
 #define KEYBOARD_H
 
+#include <QMutex>
+
 #include "inputdevice.h"
 #include "inputdeviceevent.h"
 
@@ -9,7 +11,12 @@
 // and keyReleaseEvent() functions, to handle incoming key values
 // and turn the into valid RETRO_PAD button.
 
-using InputDeviceMapping = QHash< int, InputDeviceEvent::Event >;
+// With setDirectInput(), keys come from insertKey() instead, called by an EvdevKeyboard on the evdevThread.
+// The window's key events are then only used in edit mode, which is also when insertKey() ignores them.
+// Only one of the two sources writes the states and the frontend queue at a time, the switch is made under a lock.
+
+// One key may drive several events.
+using InputDeviceMapping = QMultiHash< int, InputDeviceEvent::Event >;
 
 class Keyboard : public InputDevice {
         Q_OBJECT
@@ -22,21 +29,104 @@ class Keyboard : public InputDevice {
 
         explicit Keyboard( QObject *parent = 0 );
 
-        InputDeviceMapping &mapping();
+        const InputDeviceMapping &mapping() const;
+
+        // Replaces the whole mapping.
+        void setKeyMapping( const InputDeviceMapping &mapping );
+
+        // Every button 'key' drives, as an InputState button mask. Lock free on the GUI thread.
+        quint32 buttonsForKey( const int key ) const {
+            return keyTable.lookup( key );
+        }
 
         bool loadMapping() override;
         void saveMapping() override;
 
+        // Only insertKey() feeds the Keyboard outside of edit mode, insert() is ignored then and insertKey() is
+        // ignored otherwise. Safe to call from any thread, it waits for an insert already underway.
+        void setDirectInput( const bool direct );
+        bool directInput() const;
+
+        // Same as insert(), from the thread that reads the keyboard. 'time' is when the key was pressed, see
+        // InputEvent::currentTime().
+        void insertKey( const int key, const int16_t pressed, const qint64 time );
+
     public slots:
 
         void insert( const int &event, int16_t pressed );
         void setMapping( const QVariantMap mapping ) override;
 
+    signals:
+
+        // Emitted after the window's key events changed the state, so the frontend events don't have to wait for
+        // the next poll.
+        void keysInserted();
+
     private:
 
+        // The mapping, compiled into InputState button masks. Qt key codes are sparse, but nearly every key
+        // falls into one of two dense pages: Latin-1 (Qt::Key_Space to Qt::Key_ydiaeresis) and the special
+        // keys right after Qt::Key_Escape (0x01000000). Anything else, like the media keys, is hashed.
+        struct KeyTable {
+
+            static const int pageSize = 256;
+            static const int specialKeys = 0x01000000;
+
+            quint32 latin1[ pageSize ];
+            quint32 special[ pageSize ];
+            QHash<int, quint32> other;
+
+            KeyTable()
+                : latin1(),
+                  special() {
+            }
+
+            quint32 lookup( const int key ) const {
+                if( static_cast<unsigned>( key ) < pageSize ) {
+                    return latin1[ key ];
+                }
+
+                if( static_cast<unsigned>( key - specialKeys ) < pageSize ) {
+                    return special[ key - specialKeys ];
+                }
+
+                return other.isEmpty() ? 0 : other.value( key, 0 );
+            }
+
+            quint32 &entry( const int key ) {
+                if( static_cast<unsigned>( key ) < pageSize ) {
+                    return latin1[ key ];
+                }
+
+                if( static_cast<unsigned>( key - specialKeys ) < pageSize ) {
+                    return special[ key - specialKeys ];
+                }
+
+                return other[ key ];
+            }
+
+        };
+
         void loadDefaultMapping();
 
+        // Rebuilds the keyTable from the deviceMapping, call this after every change to it.
+        void compileMapping();
+
+        // Presses or releases every button in 'buttons' at once.
+        void insertButtons( const quint32 buttons, const int16_t pressed, const qint64 time );
+
         InputDeviceMapping deviceMapping;
+        KeyTable keyTable;
+
+        // insertKey() reads the keyTable from another thread, while the GUI thread may rebuild it.
+        QMutex mappingMutex;
+
+        // Held by insert() and insertKey() while they write, and by setDirectInput(), so the GUI thread and the
+        // evdevThread never write the states or the frontend queue at the same time.
+        QMutex sourceMutex;
+
+        // Only changed under the sourceMutex.
+        std::atomic<bool> direct;
 
 };
 
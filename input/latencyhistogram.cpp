@@ -0,0 +1,90 @@
+#include "latencyhistogram.h"
+
+LatencyHistogram::LatencyHistogram() {
+    reset();
+}
+
+void LatencyHistogram::record( const qint64 nanoseconds ) {
+
+    buckets[ bucket( nanoseconds ) ].fetch_add( 1, std::memory_order_relaxed );
+    total.fetch_add( 1, std::memory_order_relaxed );
+
+    qint64 current = maximum.load( std::memory_order_relaxed );
+
+    while( nanoseconds > current && !maximum.compare_exchange_weak( current, nanoseconds, std::memory_order_relaxed ) ) {
+    }
+
+}
+
+void LatencyHistogram::reset() {
+
+    for( auto &count : buckets ) {
+        count.store( 0, std::memory_order_relaxed );
+    }
+
+    total.store( 0, std::memory_order_relaxed );
+    maximum.store( 0, std::memory_order_relaxed );
+
+}
+
+quint64 LatencyHistogram::count() const {
+    return total.load( std::memory_order_relaxed );
+}
+
+qint64 LatencyHistogram::max() const {
+    return maximum.load( std::memory_order_relaxed );
+}
+
+qint64 LatencyHistogram::percentile( const double fraction ) const {
+
+    quint64 counts[ bucketCount ];
+    quint64 sum = 0;
+
+    // Work from one copy, record() may be running.
+    for( int i = 0; i < bucketCount; ++i ) {
+        counts[ i ] = buckets[ i ].load( std::memory_order_relaxed );
+        sum += counts[ i ];
+    }
+
+    if( sum == 0 ) {
+        return 0;
+    }
+
+    quint64 rank = qMax<quint64>( 1, static_cast<quint64>( fraction * sum + 0.5 ) );
+    quint64 seen = 0;
+
+    for( int i = 0; i < bucketCount; ++i ) {
+        seen += counts[ i ];
+
+        if( seen >= rank ) {
+            return qMin<qint64>( Q_INT64_C( 1 ) << i, max() );
+        }
+    }
+
+    return max();
+
+}
+
+QVariantMap LatencyHistogram::toVariantMap() const {
+
+    QVariantMap map;
+    map.insert( "count", count() );
+    map.insert( "p50", percentile( 0.50 ) / 1000.0 );
+    map.insert( "p99", percentile( 0.99 ) / 1000.0 );
+    map.insert( "max", max() / 1000.0 );
+    return map;
+
+}
+
+int LatencyHistogram::bucket( const qint64 nanoseconds ) {
+
+    // Bucket i holds ( 2^(i-1), 2^i ].
+    int index = 0;
+
+    while( index < bucketCount - 1 && ( Q_INT64_C( 1 ) << index ) < nanoseconds ) {
+        ++index;
+    }
+
+    return index;
+
+}
@@ -0,0 +1,47 @@
+#ifndef LATENCYHISTOGRAM_H
+#define LATENCYHISTOGRAM_H
+
+#include <QtGlobal>
+#include <QVariantMap>
+
+#include <atomic>
+
+// LatencyHistogram counts durations in power of two nanosecond buckets, so recording one is a couple of
+// relaxed atomic adds, and it never allocates.
+
+// Percentiles are the upper bound of the bucket they land in, which is at most twice the real value.
+// The maximum is exact.
+
+// Any thread may record and read, value() and latchState() record from whichever thread reads the device.
+
+class LatencyHistogram {
+
+    public:
+
+        static const int bucketCount = 48;
+
+        LatencyHistogram();
+
+        void record( const qint64 nanoseconds );
+        void reset();
+
+        quint64 count() const;
+        qint64 max() const;
+
+        // 'fraction' is between 0 and 1, 0.99 for p99. Returns 0 if nothing was recorded.
+        qint64 percentile( const double fraction ) const;
+
+        // count, p50, p99 and max, the durations in microseconds.
+        QVariantMap toVariantMap() const;
+
+    private:
+
+        std::atomic<quint64> buckets[ bucketCount ];
+        std::atomic<quint64> total;
+        std::atomic<qint64> maximum;
+
+        static int bucket( const qint64 nanoseconds );
+
+};
+
+#endif // LATENCYHISTOGRAM_H
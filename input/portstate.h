@@ -0,0 +1,69 @@
+#ifndef PORTSTATE_H
+#define PORTSTATE_H
+
+#include <QtGlobal>
+
+#include "libretro.h"
+#include "inputstate.h"
+
+// PortState is one port as InputManager::latchFrame() sampled it. The core's retro_input_state callback is
+// answered from these with value(), so it never touches an InputDevice.
+
+struct PortState {
+
+        PortState()
+            : pressedSinceLatch( 0 ),
+              connected( false ) {
+        }
+
+        // Held now or pressed at any point since the previous latch.
+        quint32 buttons() const {
+            return state.buttons | pressedSinceLatch;
+        }
+
+        // Answers a retro_input_state query.
+        int16_t value( const unsigned device, const unsigned index, const unsigned id ) const {
+
+            switch( device & RETRO_DEVICE_MASK ) {
+
+                // A tap that was already released counts as held for this frame.
+                case RETRO_DEVICE_JOYPAD:
+#ifdef RETRO_DEVICE_ID_JOYPAD_MASK
+                    if( id == RETRO_DEVICE_ID_JOYPAD_MASK ) {
+                        return static_cast<int16_t>( buttons() & 0xffff );
+                    }
+#endif
+                    return id < InputDeviceEvent::Unknown ? static_cast<int16_t>( ( buttons() >> id ) & 1 ) : 0;
+
+                case RETRO_DEVICE_ANALOG:
+#ifdef RETRO_DEVICE_INDEX_ANALOG_BUTTON
+                    if( index == RETRO_DEVICE_INDEX_ANALOG_BUTTON ) {
+                        if( id == RETRO_DEVICE_ID_JOYPAD_L2 || id == RETRO_DEVICE_ID_JOYPAD_R2 ) {
+                            return state.value( static_cast<InputDeviceEvent::Event>( id ) );
+                        }
+
+                        return id < InputDeviceEvent::Unknown && ( ( buttons() >> id ) & 1 ) ? 0x7fff : 0;
+                    }
+#endif
+                    // LEFT/RIGHT then X/Y, the same order as InputState::Axis.
+                    return index <= RETRO_DEVICE_INDEX_ANALOG_RIGHT && id <= RETRO_DEVICE_ID_ANALOG_Y
+                           ? state.axes[ index * 2 + id ] : 0;
+
+                default:
+                    return 0;
+
+            }
+
+        }
+
+        // The state at the moment of the latch
+        InputState state;
+
+        // Buttons that were pressed and released again between two latches, see InputDevice::takePressedButtons()
+        quint32 pressedSinceLatch;
+
+        bool connected;
+
+};
+
+#endif // PORTSTATE_H
@@ -0,0 +1,409 @@
+#include "profilestore.h"
+
+#include "logging.h"
+
+#include <QDir>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <QVector>
+
+#include <cstring>
+
+namespace {
+
+    const char storeMagic[ 8 ] = { 'P', 'H', 'X', 'P', 'R', 'F', '0', '1' };
+
+    // All offsets are from the start of the file.
+    struct ProfileStoreHeader {
+        char magic[ 8 ];
+        quint32 entryCount;
+
+        // Open addressed hash table of ( entry index + 1 ), 0 means empty. Always a power of two.
+        quint32 tableSize;
+        quint32 tableOffset;
+
+        quint32 entriesOffset;
+        quint32 blobsOffset;
+        quint32 blobsSize;
+    };
+
+    // The key and the profile are stored back to back in the blobs.
+    struct ProfileStoreEntry {
+        quint32 offset;
+        quint32 keySize;
+        quint32 profileSize;
+    };
+
+    quint32 fnv1a( const char *data, const int size ) {
+
+        quint32 hash = 2166136261u;
+
+        for( int i = 0; i < size; ++i ) {
+            hash ^= static_cast<uchar>( data[ i ] );
+            hash *= 16777619u;
+        }
+
+        return hash;
+
+    }
+
+    quint32 align( const quint32 offset ) {
+        return ( offset + 7 ) & ~7u;
+    }
+
+}
+
+ProfileStore::ProfileStore()
+    : data( nullptr ),
+      dataSize( 0 ),
+      queuedGeneration( 0 ),
+      writtenGeneration( 0 ),
+      stopping( false ),
+      writer( this ) {
+
+    QString dataDir = QStandardPaths::writableLocation( QStandardPaths::AppDataLocation );
+    path = dataDir + QStringLiteral( "/profiles.bin" );
+
+    if( !open() && QFile::exists( path ) ) {
+        qCWarning( phxInput ) << path << "is damaged, saved mappings were lost";
+    }
+
+    writer.start( QThread::LowPriority );
+
+}
+
+ProfileStore::~ProfileStore() {
+
+    {
+        QMutexLocker locker( &pendingMutex );
+        stopping = true;
+        pendingChanged.wakeAll();
+    }
+
+    // Everything queued is written before the writer returns.
+    writer.wait();
+
+    close();
+
+}
+
+ProfileStore &ProfileStore::instance() {
+    static ProfileStore profileStore;
+    return profileStore;
+}
+
+QByteArray ProfileStore::find( const QByteArray &key ) const {
+
+    {
+        QMutexLocker locker( &pendingMutex );
+        auto it = pending.constFind( key );
+
+        if( it != pending.constEnd() ) {
+            return it.value();
+        }
+    }
+
+    QReadLocker locker( &mapLock );
+    return findMapped( key );
+
+}
+
+void ProfileStore::save( const QByteArray &key, const QByteArray &profile ) {
+
+    if( profile.size() > maxProfileSize ) {
+        qCWarning( phxInput ) << "The profile for" << key << "is too large," << profile.size() << "bytes, not saved";
+        return;
+    }
+
+    QMutexLocker locker( &pendingMutex );
+
+    // An empty profile would read back as removed anyway.
+    pending.insert( key, profile.isEmpty() ? QByteArray() : profile );
+    ++queuedGeneration;
+    pendingChanged.wakeAll();
+
+}
+
+void ProfileStore::remove( const QByteArray &key ) {
+    save( key, QByteArray() );
+}
+
+void ProfileStore::flush() {
+
+    QMutexLocker locker( &pendingMutex );
+    quint64 generation = queuedGeneration;
+
+    while( writtenGeneration < generation && writer.isRunning() ) {
+        written.wait( &pendingMutex );
+    }
+
+}
+
+//
+// Private
+//
+
+bool ProfileStore::open() {
+
+    file.setFileName( path );
+
+    if( !file.open( QIODevice::ReadOnly ) ) {
+        return false;
+    }
+
+    qint64 size = file.size();
+    const uchar *map = size >= static_cast<qint64>( sizeof( ProfileStoreHeader ) ) ? file.map( 0, size ) : nullptr;
+
+    if( map ) {
+
+        auto *header = reinterpret_cast<const ProfileStoreHeader *>( map );
+        quint64 tableEnd = header->tableOffset + static_cast<quint64>( header->tableSize ) * sizeof( quint32 );
+        quint64 entriesEnd = header->entriesOffset + static_cast<quint64>( header->entryCount ) * sizeof( ProfileStoreEntry );
+
+        bool valid = std::memcmp( header->magic, storeMagic, sizeof( storeMagic ) ) == 0
+                     && header->tableSize != 0 && ( header->tableSize & ( header->tableSize - 1 ) ) == 0
+                     && header->entryCount < header->tableSize
+                     && tableEnd <= static_cast<quint64>( size )
+                     && entriesEnd <= static_cast<quint64>( size )
+                     && header->blobsOffset + static_cast<quint64>( header->blobsSize ) <= static_cast<quint64>( size );
+
+        if( valid ) {
+            data = map;
+            dataSize = size;
+            return true;
+        }
+
+    }
+
+    file.close();
+    return false;
+
+}
+
+void ProfileStore::close() {
+    data = nullptr;
+    dataSize = 0;
+    file.close();
+}
+
+QByteArray ProfileStore::findMapped( const QByteArray &key ) const {
+
+    if( !data ) {
+        return QByteArray();
+    }
+
+    auto *header = reinterpret_cast<const ProfileStoreHeader *>( data );
+    auto *table = reinterpret_cast<const quint32 *>( data + header->tableOffset );
+    auto *entries = reinterpret_cast<const ProfileStoreEntry *>( data + header->entriesOffset );
+    auto *blobs = reinterpret_cast<const char *>( data + header->blobsOffset );
+    quint32 mask = header->tableSize - 1;
+
+    quint32 slot = fnv1a( key.constData(), key.size() ) & mask;
+
+    // The table written by save() always has an empty slot, but a damaged file may not, so give up after one lap.
+    for( quint32 probes = 0; probes < header->tableSize && table[ slot ] != 0; ++probes, slot = ( slot + 1 ) & mask ) {
+
+        quint32 index = table[ slot ] - 1;
+
+        if( index >= header->entryCount ) {
+            break;
+        }
+
+        const ProfileStoreEntry &entry = entries[ index ];
+
+        if( static_cast<quint64>( entry.offset ) + entry.keySize + entry.profileSize > header->blobsSize ) {
+            break;
+        }
+
+        if( entry.keySize == static_cast<quint32>( key.size() )
+            && std::memcmp( blobs + entry.offset, key.constData(), key.size() ) == 0 ) {
+            return QByteArray( blobs + entry.offset + entry.keySize, entry.profileSize );
+        }
+
+    }
+
+    return QByteArray();
+
+}
+
+QHash<QByteArray, QByteArray> ProfileStore::mappedProfiles() const {
+
+    QHash<QByteArray, QByteArray> profiles;
+
+    if( !data ) {
+        return profiles;
+    }
+
+    auto *header = reinterpret_cast<const ProfileStoreHeader *>( data );
+    auto *entries = reinterpret_cast<const ProfileStoreEntry *>( data + header->entriesOffset );
+    auto *blobs = reinterpret_cast<const char *>( data + header->blobsOffset );
+
+    for( quint32 i = 0; i < header->entryCount; ++i ) {
+
+        const ProfileStoreEntry &entry = entries[ i ];
+
+        if( static_cast<quint64>( entry.offset ) + entry.keySize + entry.profileSize > header->blobsSize ) {
+            continue;
+        }
+
+        profiles.insert( QByteArray( blobs + entry.offset, entry.keySize ),
+                         QByteArray( blobs + entry.offset + entry.keySize, entry.profileSize ) );
+
+    }
+
+    return profiles;
+
+}
+
+QByteArray ProfileStore::build( const QHash<QByteArray, QByteArray> &profiles ) {
+
+    QVector<ProfileStoreEntry> entries;
+    QByteArray blobs;
+
+    entries.reserve( profiles.size() );
+
+    for( auto it = profiles.constBegin(); it != profiles.constEnd(); ++it ) {
+
+        ProfileStoreEntry entry;
+        entry.offset = static_cast<quint32>( blobs.size() );
+        entry.keySize = static_cast<quint32>( it.key().size() );
+        entry.profileSize = static_cast<quint32>( it.value().size() );
+        entries.append( entry );
+
+        blobs.append( it.key() );
+        blobs.append( it.value() );
+
+    }
+
+    quint32 tableSize = 16;
+
+    while( tableSize < static_cast<quint32>( entries.size() ) * 2 ) {
+        tableSize *= 2;
+    }
+
+    QVector<quint32> table( tableSize, 0 );
+
+    for( int i = 0; i < entries.size(); ++i ) {
+
+        const ProfileStoreEntry &entry = entries.at( i );
+        quint32 slot = fnv1a( blobs.constData() + entry.offset, entry.keySize ) & ( tableSize - 1 );
+
+        while( table.at( slot ) != 0 ) {
+            slot = ( slot + 1 ) & ( tableSize - 1 );
+        }
+
+        table[ slot ] = static_cast<quint32>( i + 1 );
+
+    }
+
+    ProfileStoreHeader header;
+    std::memset( &header, 0, sizeof( header ) );
+    std::memcpy( header.magic, storeMagic, sizeof( storeMagic ) );
+    header.entryCount = static_cast<quint32>( entries.size() );
+    header.tableSize = tableSize;
+    header.tableOffset = align( sizeof( header ) );
+    header.entriesOffset = align( header.tableOffset + tableSize * sizeof( quint32 ) );
+    header.blobsOffset = align( header.entriesOffset + entries.size() * sizeof( ProfileStoreEntry ) );
+    header.blobsSize = static_cast<quint32>( blobs.size() );
+
+    QByteArray store( header.blobsOffset + header.blobsSize, '\0' );
+    char *out = store.data();
+
+    std::memcpy( out, &header, sizeof( header ) );
+    std::memcpy( out + header.tableOffset, table.constData(), tableSize * sizeof( quint32 ) );
+    std::memcpy( out + header.entriesOffset, entries.constData(), entries.size() * sizeof( ProfileStoreEntry ) );
+    std::memcpy( out + header.blobsOffset, blobs.constData(), blobs.size() );
+
+    return store;
+
+}
+
+bool ProfileStore::write( const QHash<QByteArray, QByteArray> &batch ) {
+
+    QHash<QByteArray, QByteArray> profiles;
+
+    {
+        QReadLocker locker( &mapLock );
+        profiles = mappedProfiles();
+    }
+
+    for( auto it = batch.constBegin(); it != batch.constEnd(); ++it ) {
+
+        if( it.value().isNull() ) {
+            profiles.remove( it.key() );
+        }
+
+        else {
+            profiles.insert( it.key(), it.value() );
+        }
+
+    }
+
+    QByteArray store = build( profiles );
+
+    QDir().mkpath( QFileInfo( path ).absolutePath() );
+    QSaveFile saveFile( path );
+
+    if( !saveFile.open( QIODevice::WriteOnly ) || saveFile.write( store ) != store.size() ) {
+        qCWarning( phxInput ) << "Unable to write" << path << ":" << saveFile.errorString();
+        return false;
+    }
+
+    // Some platforms can't rename over a mapped file, readers wait for the rename.
+    QWriteLocker locker( &mapLock );
+    close();
+
+    bool committed = saveFile.commit();
+
+    if( !committed ) {
+        qCWarning( phxInput ) << "Unable to replace" << path << ":" << saveFile.errorString();
+    }
+
+    open();
+    return committed;
+
+}
+
+void ProfileStore::writeLoop() {
+
+    QMutexLocker locker( &pendingMutex );
+
+    forever {
+
+        while( writtenGeneration == queuedGeneration && !stopping ) {
+            pendingChanged.wait( &pendingMutex );
+        }
+
+        if( writtenGeneration == queuedGeneration ) {
+            return;
+        }
+
+        // The batch stays in pending, and visible to find(), until it's on disk.
+        QHash<QByteArray, QByteArray> batch = pending;
+        quint64 generation = queuedGeneration;
+
+        locker.unlock();
+        bool saved = write( batch );
+        locker.relock();
+
+        // Failed saves stay pending, the next save() tries them again.
+        if( saved ) {
+            for( auto it = batch.constBegin(); it != batch.constEnd(); ++it ) {
+
+                auto current = pending.find( it.key() );
+
+                // Unless it was saved again in the meantime. save() never queues an empty, non-null profile.
+                if( current != pending.end() && current.value() == it.value() ) {
+                    pending.erase( current );
+                }
+
+            }
+        }
+
+        writtenGeneration = generation;
+        written.wakeAll();
+
+    }
+
+}
@@ -0,0 +1,95 @@
+#ifndef PROFILESTORE_H
+#define PROFILESTORE_H
+
+#include <QByteArray>
+#include <QFile>
+#include <QHash>
+#include <QMutex>
+#include <QReadWriteLock>
+#include <QThread>
+#include <QWaitCondition>
+
+// ProfileStore holds the user's own mappings, one binary profile per device, keyed by the joystick GUID (or
+// "Keyboard"). What a profile contains is up to the device, see Joystick and Keyboard.
+
+// Every profile lives in a single file in the app data directory, which is memory mapped and indexed the same way
+// as the ControllerDB, so loading a profile when a controller is plugged in is one hash lookup. save() never touches
+// the disk: the profile is queued and a background thread rewrites the file, then atomically renames it over the
+// old one. A profile that was saved but not written yet is already returned by find().
+
+class ProfileStore {
+
+    public:
+
+        static ProfileStore &instance();
+
+        // A copy of the profile saved under 'key', empty if there is none. Safe from any thread.
+        QByteArray find( const QByteArray &key ) const;
+
+        // Queues 'profile' to be written. Never blocks on the disk. Safe from any thread.
+        void save( const QByteArray &key, const QByteArray &profile );
+        void remove( const QByteArray &key );
+
+        // Blocks until every profile saved so far has been written (or failed to be).
+        void flush();
+
+        // Profiles longer than this aren't stored.
+        static const int maxProfileSize = 64 * 1024;
+
+    private:
+
+        ProfileStore();
+        ~ProfileStore();
+        Q_DISABLE_COPY( ProfileStore )
+
+        class Writer : public QThread {
+            public:
+                explicit Writer( ProfileStore *store ) : store( store ) {}
+
+            protected:
+                void run() override {
+                    store->writeLoop();
+                }
+
+            private:
+                ProfileStore *store;
+        };
+
+        QString path;
+
+        // Guards the mapped file, only held for writing while it's renamed and mapped again.
+        mutable QReadWriteLock mapLock;
+        QFile file;
+        const uchar *data;
+        qint64 dataSize;
+
+        // Saved but not written yet, a null QByteArray means removed. Guarded by pendingMutex.
+        mutable QMutex pendingMutex;
+        QWaitCondition pendingChanged;
+        QWaitCondition written;
+        QHash<QByteArray, QByteArray> pending;
+        quint64 queuedGeneration;
+        quint64 writtenGeneration;
+        bool stopping;
+
+        Writer writer;
+
+        bool open();
+        void close();
+
+        // Looks 'key' up in the mapped file. mapLock must be held.
+        QByteArray findMapped( const QByteArray &key ) const;
+
+        // Every profile in the mapped file. mapLock must be held.
+        QHash<QByteArray, QByteArray> mappedProfiles() const;
+
+        static QByteArray build( const QHash<QByteArray, QByteArray> &profiles );
+
+        // Writes 'batch' over the mapped profiles. Returns false if the file couldn't be replaced.
+        bool write( const QHash<QByteArray, QByteArray> &batch );
+
+        void writeLoop();
+
+};
+
+#endif // PROFILESTORE_H
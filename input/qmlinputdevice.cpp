@@ -1,11 +1,31 @@
 #include "qmlinputdevice.h"
 
 QMLInputDevice::QMLInputDevice( QObject *parent )
-    : InputDevice( parent ) {
+    : InputDevice( parent ),
+      qmlA( false ),
+      qmlB( false ),
+      qmlX( false ),
+      qmlY( false ),
+      qmlLeft( false ),
+      qmlRight( false ),
+      qmlUp( false ),
+      qmlDown( false ),
+      qmlStart( false ),
+      qmlSelect( false ),
+      qmlGuide( false ),
+      qmlLeftShoulder( false ),
+      qmlRightShoulder( false ),
+      qmlLeftTrigger( false ),
+      qmlRightTrigger( false ),
+      qmlButtons( 0 ),
+      pendingChangedMask( 0 ),
+      flushPending( false ) {
 }
 
 void QMLInputDevice::insert( const InputDeviceEvent::Event &event, const int &state ) {
 
+    setButton( event, state );
+
     // Process the incoming event and assign it to the correct button value.
     switch( event ) {
 
@@ -301,4 +321,108 @@ bool QMLInputDevice::rightTrigger() const {
     return qmlRightTrigger;
 }
 
+quint32 QMLInputDevice::buttons() const {
+    return qmlButtons;
+}
+
+void QMLInputDevice::setButton( const InputDeviceEvent::Event &event, const bool state ) {
+
+    quint32 mask = InputState::mask( event );
+    quint32 buttons = state ? ( qmlButtons | mask ) : ( qmlButtons & ~mask );
+
+    if( buttons == qmlButtons ) {
+        return;
+    }
+
+    pendingChangedMask |= buttons ^ qmlButtons;
+    qmlButtons = buttons;
+
+    // Everything else that arrives before the event loop gets back to us is folded into the same emission.
+    if( !flushPending ) {
+        flushPending = true;
+        QMetaObject::invokeMethod( this, "flushButtons", Qt::QueuedConnection );
+    }
+
+}
+
+void QMLInputDevice::insertBatch( const InputEventList &events ) {
+
+    for( const InputEvent &event : events ) {
+
+        auto button = static_cast<InputDeviceEvent::Event>( event.event );
+        quint32 mask = InputState::mask( button );
+
+        // Nothing to hold
+        if( !mask ) {
+            insert( button, event.value );
+            continue;
+        }
+
+        quint32 &held = heldButtons[ event.device ];
+        held = event.value ? ( held | mask ) : ( held & ~mask );
+
+        if( !held ) {
+            heldButtons.remove( event.device );
+        }
+
+        insert( button, isHeld( button ) );
+
+    }
+
+    flushButtons();
+
+}
+
+void QMLInputDevice::releaseDevice( const int device ) {
+
+    quint32 released = heldButtons.take( device );
+
+    if( !released ) {
+        return;
+    }
+
+    for( int i = 0; i < InputDeviceEvent::Unknown; ++i ) {
+        auto button = static_cast<InputDeviceEvent::Event>( i );
+
+        if( ( released & InputState::mask( button ) ) && !isHeld( button ) ) {
+            insert( button, false );
+        }
+    }
+
+    flushButtons();
+
+}
+
+bool QMLInputDevice::isHeld( const InputDeviceEvent::Event &event ) const {
+
+    quint32 mask = InputState::mask( event );
+
+    for( quint32 held : heldButtons ) {
+        if( held & mask ) {
+            return true;
+        }
+    }
+
+    return false;
+
+}
+
+void QMLInputDevice::flushButtons() {
+
+    // insertBatch() may have flushed already
+    if( !flushPending ) {
+        return;
+    }
+
+    flushPending = false;
+
+    // A button pressed and released within the same pass is still reported as changed, so
+    // handlers don't miss quick taps.
+    quint32 changedMask = pendingChangedMask;
+    pendingChangedMask = 0;
+
+    emit buttonsChanged( changedMask );
+
+}
+
 
@@ -2,18 +2,29 @@
 #define QMLINPUTDEVICE_H
 
 #include "inputdevice.h"
+#include "inputevent.h"
 
 // This QMLInputDevice is responsible for controlling the frontend, such as selecting games, and
 // editing settings while using any InputDevice. The main reason for this is so the a Joystick
 // instance can control the UI.
 
-// Currently, every single InputDevice stored in the InputManager, should connect their
-// InputDevice::inputDeviceEvent() signal to this classes insert() function.
-// The actual button presses can then be obtained by reading the Q_PROPERTY values.
+// The InputManager owns the one QMLInputDevice (see InputManager::frontendDevice). It collects the edges of every
+// InputDevice and delivers them as one batch through its frontendEvents() signal, which it connects to this classes
+// insertBatch() function. The actual button presses can then be obtained by reading the Q_PROPERTY values.
+
+// insertBatch() keeps track of which device holds which button, so a button stays pressed for as long as any
+// device holds it.
+
+// Besides the per-button properties, every button is also packed into the 'buttons' property, one bit per
+// InputDeviceEvent::Event (see InputState::bit()). Its buttonsChanged() signal carries the bits that changed and
+// fires at most once per event loop pass, no matter how many buttons changed, so a QML handler on it
+// runs once per batch of input instead of once per button.
 
 // There should only ever be one and only one QMLInputDevice every created.
 class QMLInputDevice : public InputDevice {
         Q_OBJECT
+        Q_PROPERTY( quint32 buttons READ buttons NOTIFY buttonsChanged )
+
         Q_PROPERTY( bool a READ a NOTIFY aChanged )
         Q_PROPERTY( bool b READ b NOTIFY bChanged )
         Q_PROPERTY( bool x READ x NOTIFY xChanged )
@@ -59,10 +70,22 @@ class QMLInputDevice : public InputDevice {
         bool leftTrigger() const;
         bool rightTrigger() const;
 
+        quint32 buttons() const;
+
     public slots:
 
         void insert( const InputDeviceEvent::Event &value, const int &state );
 
+        // Applies a whole batch, then emits buttonsChanged() once.
+        void insertBatch( const InputEventList &events );
+
+        // Lets go of every button 'device' still holds, for when it's unplugged.
+        void releaseDevice( const int device );
+
+    private slots:
+
+        void flushButtons();
+
     signals:
 
         void aChanged();
@@ -84,8 +107,24 @@ class QMLInputDevice : public InputDevice {
         void leftTriggerChanged();
         void rightTriggerChanged();
 
+        void buttonsChanged( quint32 changedMask );
+
     private:
 
+        quint32 qmlButtons;
+
+        // Bits changed since buttonsChanged() was last emitted
+        quint32 pendingChangedMask;
+        bool flushPending;
+
+        // The buttons each device holds, keyed by InputEvent::device. Devices holding nothing are left out.
+        QHash<int, quint32> heldButtons;
+
+        // Whether any device still holds the button behind 'event'.
+        bool isHeld( const InputDeviceEvent::Event &event ) const;
+
+        void setButton( const InputDeviceEvent::Event &event, const bool state );
+
         bool qmlA;
         bool qmlB;
         bool qmlX;
@@ -2,35 +2,32 @@
 
 #include "logging.h"
 
-#include <QFile>
-#include <QMutexLocker>
+#include <QtConcurrent>
 
+const int SDLEventLoop::defaultPollRate = 200;
 
 SDLEventLoop::SDLEventLoop( QObject *parent )
     : QObject( parent ),
       sdlPollTimer( this ),
-      numOfDevices( 0 ),
-      forceEventsHandling( true ) {
+      deviceThread( QThread::currentThread() ),
+      maxTick( 0 ),
+      frontendQueue( nullptr ),
+      editModeQueue( nullptr ) {
 
-    // TODO: The poll timer isn't in the sdlEventLoopThread. It needs to be.
-
-    // Ensures the resources at loaded at startup, even during
-    // static compilation.
-    Q_INIT_RESOURCE( controllerdb );
-    QFile gameControllerDBFile( ":/input/gamecontrollerdb.txt" );
-    Q_ASSERT( gameControllerDBFile.open( QIODevice::ReadOnly ) );
-
-    auto mappingData = gameControllerDBFile.readAll();
-
-    SDL_SetHint( SDL_HINT_GAMECONTROLLERCONFIG, mappingData.constData() );
-
-    gameControllerDBFile.close();
+    // Map the compiled controller database now. SDL only gets the mapping of a device when it's
+    // plugged in, see SDL_JOYDEVICEADDED below.
+    qCDebug( phxInput ) << ControllerDB::instance().size() << "controller mappings available";
 
     for( int i = 0; i < Joystick::maxNumOfDevices; ++i ) {
         sdlDeviceList.append( nullptr );
     }
 
-    sdlPollTimer.setInterval( 5 );
+    // Never grow while polling.
+    activeJoysticks.reserve( Joystick::maxNumOfDevices );
+
+    // A coarse timer may fire up to 5% late, which is a whole extra poll period at 200 Hz.
+    sdlPollTimer.setTimerType( Qt::PreciseTimer );
+    setPollRate( defaultPollRate );
 
     connect( &sdlPollTimer, &QTimer::timeout, this, &SDLEventLoop::pollEvents );
 
@@ -39,236 +36,400 @@ SDLEventLoop::SDLEventLoop( QObject *parent )
 
 }
 
+SDLEventLoop::~SDLEventLoop() {
+
+    // Don't leak devices that were still being opened.
+    for( const auto &pending : pendingDevices ) {
+        pending.watcher->waitForFinished();
+        delete pending.joystick;
+    }
+
+    qDeleteAll( virtualJoysticks );
+
+}
+
 void SDLEventLoop::pollEvents() {
 
-    if( !forceEventsHandling ) {
+    qint64 start = InputEvent::currentTime();
+
+    // Both halves run every tick, so one device being removed, or being remapped, never
+    // delays sampling the others.
+    handleEvents();
+    pollDevices();
 
-        // Update all connected controller states.
-        SDL_GameControllerUpdate();
+    qint64 duration = InputEvent::currentTime() - start;
 
-        // All joystick instance ID's are stored inside of this map.
-        // This is necessary because the instance ID could be any number, and
-        // so cannot be used for indexing the deviceLocationMap. The value of the map
-        // is the actual index that the sdlDeviceList uses.
-        for( auto &key : deviceLocationMap.keys() ) {
+    // Only this thread writes it.
+    if( duration > maxTick.load( std::memory_order_relaxed ) ) {
+        maxTick.store( duration, std::memory_order_relaxed );
+    }
 
-            auto index = deviceLocationMap[ key ];
+    emit polled();
 
-            auto *joystick = sdlDeviceList.at( index );
-            auto *sdlGamepad = joystick->sdlDevice();
+}
 
-            // Check to see if sdlGamepad is actually connected. If it isn't this will terminate the
-            // polling and initialize the event handling.
+void SDLEventLoop::handleEvents() {
 
-            forceEventsHandling = joystick->editMode()
-                                  | ( SDL_GameControllerGetAttached( sdlGamepad ) == SDL_FALSE );
+    SDL_Event sdlEvent;
 
-            if( forceEventsHandling ) {
-                return;
-            }
+    // Handles SDL_CONTROLLERDEVICEADDED, SDL_CONTROLLERDEVICEREMOVED and button events. SDL_PollEvent() also pumps SDL's joystick states.
+    while( SDL_PollEvent( &sdlEvent ) ) {
 
-            bool left, right, down, up, a, b, x, y, start, select, rightShoulder, leftShoulder;
-            bool guide, leftStick, rightStick;
+        switch( sdlEvent.type ) {
 
-            qint16 leftTrigger, rightTrigger, leftXAxis, leftYAxis, rightXAxis, rightYAxis;
-            Q_UNUSED( rightXAxis );
-            Q_UNUSED( rightYAxis );
+            case SDL_JOYDEVICEADDED: {
 
-            // Read D-PAD Button States
-            left = joystick->getButtonState( SDL_CONTROLLER_BUTTON_DPAD_LEFT );
-            right = joystick->getButtonState( SDL_CONTROLLER_BUTTON_DPAD_RIGHT );
-            up = joystick->getButtonState( SDL_CONTROLLER_BUTTON_DPAD_UP );
-            down = joystick->getButtonState( SDL_CONTROLLER_BUTTON_DPAD_DOWN );
+                int which = sdlEvent.jdevice.which;
+                const auto &controllerDB = ControllerDB::instance();
+                auto *entry = controllerDB.find( SDL_JoystickGetDeviceGUID( which ) );
 
-            // Read Menu Button States
-            start = joystick->getButtonState( SDL_CONTROLLER_BUTTON_START );
-            select = joystick->getButtonState( SDL_CONTROLLER_BUTTON_BACK );
-            guide = joystick->getButtonState( SDL_CONTROLLER_BUTTON_GUIDE );
+                if( !entry ) {
+                    break;
+                }
 
-            // Read Action Button States
-            a = joystick->getButtonState( SDL_CONTROLLER_BUTTON_A );
-            b = joystick->getButtonState( SDL_CONTROLLER_BUTTON_B );
-            x = joystick->getButtonState( SDL_CONTROLLER_BUTTON_X );
-            y = joystick->getButtonState( SDL_CONTROLLER_BUTTON_Y );
+                if( SDL_GameControllerAddMapping( controllerDB.mappingString( entry ) ) == -1 ) {
+                    qCWarning( phxInput ) << "Unable to add the controller mapping:" << SDL_GetError();
+                    break;
+                }
 
-            // Read Analog Click Button States
-            leftStick = joystick->getButtonState( SDL_CONTROLLER_BUTTON_LEFTSTICK );
-            rightStick = joystick->getButtonState( SDL_CONTROLLER_BUTTON_RIGHTSTICK );
+                // SDL won't send SDL_CONTROLLERDEVICEADDED for a device it didn't have a mapping for
+                // when it was plugged in, so open it now. If SDL does send one, it's ignored as a duplicate.
+                if( SDL_IsGameController( which ) && !isKnownDevice( which ) ) {
+                    openDevice( which );
+                }
 
-            // Read Shoulder Button States
-            leftShoulder = joystick->getButtonState( SDL_CONTROLLER_BUTTON_LEFTSHOULDER );
-            rightShoulder = joystick->getButtonState( SDL_CONTROLLER_BUTTON_RIGHTSHOULDER );
+                break;
 
-            // Check if the joystick has digital triggers, like the Wii U Pro Controlle, and
-            // read the values.
+            }
 
-            leftTrigger = joystick->getAxisState( SDL_CONTROLLER_AXIS_TRIGGERLEFT );
+            case SDL_CONTROLLERDEVICEADDED: {
 
-            rightTrigger = joystick->getAxisState( SDL_CONTROLLER_AXIS_TRIGGERRIGHT );
+                // This needs to be checked for, because the first time a controller
+                // sdl starts up, it fires this signal twice, pretty annoying...
 
-            //gamecontroller->mapping.buttons[button]
-            // Read Analog Joystick Values
-            leftXAxis = joystick->getAxisState( SDL_CONTROLLER_AXIS_LEFTX );
-            leftYAxis = joystick->getAxisState( SDL_CONTROLLER_AXIS_LEFTY );
-            rightXAxis = joystick->getAxisState( SDL_CONTROLLER_AXIS_RIGHTX );
-            rightYAxis = joystick->getAxisState( SDL_CONTROLLER_AXIS_RIGHTY );
+                if( isKnownDevice( sdlEvent.cdevice.which ) ) {
 
-            // !analogMode means that the console being played doesn't support
-            // analog sticks. We will then have the left analog stick mimic the D-PAD.
-            if( !joystick->analogMode() ) {
+                    qCDebug( phxInput ).nospace() << "Duplicate controller added at slot "
+                                                  << sdlEvent.cdevice.which << ", ignored";
+                    break;
 
-                if( leftXAxis <= 0 ) {
-                    left |= ( leftXAxis < -joystick->deadZone() );
                 }
 
-                if( leftXAxis > 0 ) {
-                    right |= ( leftXAxis > joystick->deadZone() );
-                }
+                openDevice( sdlEvent.cdevice.which );
+
+                break;
 
-                if( leftYAxis <= 0 ) {
-                    up |= ( leftYAxis < -joystick->deadZone() );
+            }
+
+            case SDL_CONTROLLERDEVICEREMOVED: {
+
+                int index = deviceLocationMap.value( sdlEvent.cdevice.which, -1 );
+
+                if( index == -1 ) {
+                    qCDebug( phxInput ) << "Removed controller" << sdlEvent.cdevice.which << "was never added, ignored";
+                    break;
                 }
 
-                if( leftYAxis > 0 ) {
-                    down |= ( leftYAxis > joystick->deadZone() );
+                auto *joystick = sdlDeviceList.at( index );
+
+                Q_ASSERT( joystick != nullptr );
+
+                if( joystick->instanceID() == sdlEvent.cdevice.which ) {
+
+                    removeActiveJoystick( joystick );
+                    emit deviceRemoved( joystick->sdlIndex() );
+                    sdlDeviceList[ index ] = nullptr;
+                    deviceLocationMap.remove( sdlEvent.cdevice.which );
+                    break;
+
                 }
 
+                break;
+
             }
 
-            joystick->insert( InputDeviceEvent::Left, left );
-            joystick->insert( InputDeviceEvent::Right, right );
-            joystick->insert( InputDeviceEvent::Down, down );
-            joystick->insert( InputDeviceEvent::Up,  up );
+            case SDL_CONTROLLERBUTTONUP:
+            case SDL_CONTROLLERBUTTONDOWN:
+            case SDL_JOYBUTTONDOWN:
+            case SDL_JOYBUTTONUP: {
+
+                int index = deviceLocationMap.value( sdlEvent.cbutton.which, -1 );
+
+                if( index == -1 ) {
+                    break;
+                }
+
+                auto *joystick = sdlDeviceList.at( index );
 
-            joystick->insert( InputDeviceEvent::Start, start );
-            joystick->insert( InputDeviceEvent::Select, select );
+                Q_ASSERT( joystick != nullptr );
 
-            // The guide button is emitted to the frontend and is hooked up the to
-            // QMLInputDevice.
-            joystick->emitInputDeviceEvent( InputDeviceEvent::Guide, guide );
+                // Outside of edit mode, button events only catch presses that are released again before
+                // pollDevices() gets to see them. pollDevices() reads everything else.
+                if( !joystick->editMode() ) {
 
-            // The buttons are switched to a SNES controller layout.
-            // SDL GameControllers have Xbox360 controller layouts.
-            joystick->insert( InputDeviceEvent::A, b );
-            joystick->insert( InputDeviceEvent::B, a );
-            joystick->insert( InputDeviceEvent::X, y );
-            joystick->insert( InputDeviceEvent::Y, x );
+                    if( sdlEvent.type == SDL_CONTROLLERBUTTONDOWN ) {
+                        JoystickState pad;
+                        pad.buttons = 1u << sdlEvent.cbutton.button;
+                        joystick->markPressed( InputLayout::translate( joystick->layout(), pad ).buttons );
+                    }
+
+                    break;
+
+                }
+
+                int state = sdlEvent.cbutton.state;
 
-            joystick->insert( InputDeviceEvent::L3, leftStick );
-            joystick->insert( InputDeviceEvent::R3, rightStick );
+                joystick->emitEditModeEvent( sdlEvent.cbutton.button, state );
 
-            joystick->insert( InputDeviceEvent::L, leftShoulder );
-            joystick->insert( InputDeviceEvent::R, rightShoulder );
+                break;
 
-            joystick->insert( InputDeviceEvent::L2, leftTrigger );
-            joystick->insert( InputDeviceEvent::R2, rightTrigger );
+            }
 
-            //qDebug() << left << right << down << up << start << select <<
-            //         a << b << x << y << leftShoulder << rightShoulder << leftTrigger << rightTrigger
-            //     << leftStick << rightStick << leftXAxis << leftYAxis << rightYAxis << rightXAxis;
+            default:
+                break;
 
         }
 
     }
 
-    else {
+}
 
-        SDL_Event sdlEvent;
+void SDLEventLoop::pollDevices() {
 
-        // The only events that should be handled here are, SDL_CONTROLLERDEVICEADDED
-        // and SDL_CONTROLLERDEVICEREMOVED.
-        while( SDL_PollEvent( &sdlEvent ) ) {
+    // Update all connected controller states. Every device's edges are stamped with this time, which comes from
+    // the poll timer and not from whoever reads the states, see InputDevice::latency().
+    qint64 sampleTime = InputEvent::currentTime();
+    SDL_GameControllerUpdate();
 
-            switch( sdlEvent.type ) {
+    // Walk the dense list instead of the deviceLocationMap, this loop runs every tick
+    // and must not allocate.
+    for( int i = 0; i < activeJoysticks.size(); ++i ) {
 
-                case SDL_CONTROLLERDEVICEADDED: {
+        auto *joystick = activeJoysticks.at( i );
+        auto *sdlGamepad = joystick->sdlDevice();
 
-                    forceEventsHandling = false;
+        // A device that's being remapped is fed by handleEvents(), and a detached one will be
+        // removed by handleEvents() on a later tick. Either way, skip only this device.
+        if( joystick->editMode() || SDL_GameControllerGetAttached( sdlGamepad ) == SDL_FALSE ) {
+            continue;
+        }
 
-                    // This needs to be checked for, because the first time a controller
-                    // sdl starts up, it fires this signal twice, pretty annoying...
+        // Sample the whole pad at once, then translate it to RETRO_PAD buttons.
+        JoystickState pad = joystick->readAll();
+        InputState state = InputLayout::translate( joystick->layout(), pad );
 
-                    if( sdlDeviceList.at( sdlEvent.cdevice.which ) != nullptr ) {
+        // !analogMode means that the console being played doesn't support
+        // analog sticks. We will then have the left analog stick mimic the D-PAD.
+        if( !joystick->analogMode() ) {
 
-                        qCDebug( phxInput ).nospace() << "Duplicate controller added at slot "
-                                                      << sdlEvent.cdevice.which << ", ignored";
-                        break;
+            qint16 leftXAxis = pad.axis( SDL_CONTROLLER_AXIS_LEFTX );
+            qint16 leftYAxis = pad.axis( SDL_CONTROLLER_AXIS_LEFTY );
+            qreal deadZone = joystick->deadZone();
 
-                    }
+            state.buttons |= InputState::mask( InputDeviceEvent::Left ) * ( leftXAxis < -deadZone )
+                             | InputState::mask( InputDeviceEvent::Right ) * ( leftXAxis > deadZone )
+                             | InputState::mask( InputDeviceEvent::Up ) * ( leftYAxis < -deadZone )
+                             | InputState::mask( InputDeviceEvent::Down ) * ( leftYAxis > deadZone );
 
-                    auto *joystick = new Joystick( sdlEvent.cdevice.which );
+        }
 
-                    deviceLocationMap.insert( joystick->instanceID(), sdlEvent.cdevice.which );
+        // Edges are forwarded to the QMLInputDevice, the Guide button's even while a game is running.
+        joystick->insertState( state, sampleTime );
 
-                    sdlDeviceList[ sdlEvent.cdevice.which ] = joystick;
+        // Make this poll's states visible to the core all at once.
+        joystick->publishStates();
 
-                    emit deviceConnected( joystick );
+    }
 
-                    break;
+}
 
-                }
+void SDLEventLoop::start() {
+    sdlPollTimer.start();
+}
 
-                case SDL_CONTROLLERDEVICEREMOVED: {
+void SDLEventLoop::stop() {
+    sdlPollTimer.stop();
+}
 
-                    int index = deviceLocationMap.value( sdlEvent.cbutton.which, -1 );
+int SDLEventLoop::pollRate() const {
+    return 1000 / sdlPollTimer.interval();
+}
 
-                    Q_ASSERT( index != -1 );
+void SDLEventLoop::setEventQueues( InputEventQueue *frontend, InputEventQueue *editMode ) {
+    frontendQueue = frontend;
+    editModeQueue = editMode;
+}
 
-                    auto *joystick = sdlDeviceList.at( index );
+void SDLEventLoop::setPollRate( const int rate ) {
+    sdlPollTimer.setInterval( qBound( 1, 1000 / qMax( 1, rate ), 1000 ) );
+}
 
-                    Q_ASSERT( joystick != nullptr );
+qint64 SDLEventLoop::maxTickDuration() const {
+    return maxTick.load( std::memory_order_relaxed );
+}
 
-                    if( joystick->instanceID() == sdlEvent.cdevice.which ) {
+void SDLEventLoop::resetTickStats() {
+    maxTick.store( 0, std::memory_order_relaxed );
+}
 
-                        emit deviceRemoved( joystick->sdlIndex() );
-                        sdlDeviceList[ index ] = nullptr;
-                        deviceLocationMap.remove( sdlEvent.cbutton.which );
-                        forceEventsHandling = true;
-                        break;
+int SDLEventLoop::virtualJoystickCount() const {
+    return virtualJoysticks.size();
+}
 
-                    }
+VirtualJoystick *SDLEventLoop::virtualJoystick( const int index ) const {
+    return virtualJoysticks.value( index, nullptr );
+}
 
-                    break;
+void SDLEventLoop::attachVirtualJoysticks( const int count ) {
 
-                }
+    for( int i = 0; i < count; ++i ) {
 
-                case SDL_CONTROLLERBUTTONUP:
-                case SDL_CONTROLLERBUTTONDOWN:
-                case SDL_JOYBUTTONDOWN:
-                case SDL_JOYBUTTONUP: {
+        auto *joystick = new VirtualJoystick;
 
-                    int index = deviceLocationMap.value( sdlEvent.cbutton.which, -1 );
-                    Q_ASSERT( index != -1 );
+        if( !joystick->attach() ) {
+            delete joystick;
+            return;
+        }
 
-                    auto *joystick = sdlDeviceList.at( index );
+        virtualJoysticks.append( joystick );
 
-                    Q_ASSERT( joystick != nullptr );
+    }
 
-                    int state = sdlEvent.cbutton.state;
+}
 
-                    joystick->emitEditModeEvent( sdlEvent.cbutton.button, state );
+bool SDLEventLoop::verifyConsistency() const {
 
-                    break;
+    bool consistent = true;
 
-                }
+    for( auto it = deviceLocationMap.constBegin(); it != deviceLocationMap.constEnd(); ++it ) {
 
-                default:
-                    break;
+        Joystick *joystick = sdlDeviceList.value( it.value(), nullptr );
 
-            }
+        if( !joystick ) {
+            qCWarning( phxInput ) << "Instance" << it.key() << "maps to empty slot" << it.value();
+            consistent = false;
+            continue;
+        }
 
+        if( joystick->instanceID() != it.key() || joystick->sdlIndex() != it.value() ) {
+            qCWarning( phxInput ) << "Instance" << it.key() << "maps to slot" << it.value() << "which holds instance"
+                                  << joystick->instanceID() << "at slot" << joystick->sdlIndex();
+            consistent = false;
         }
 
+        if( !activeJoysticks.contains( joystick ) ) {
+            qCWarning( phxInput ) << "Instance" << it.key() << "isn't being polled";
+            consistent = false;
+        }
+
+    }
+
+    int occupied = sdlDeviceList.size() - sdlDeviceList.count( nullptr );
+
+    if( occupied != deviceLocationMap.size() || activeJoysticks.size() != deviceLocationMap.size() ) {
+        qCWarning( phxInput ) << occupied << "slots are in use and" << activeJoysticks.size() << "devices are polled,"
+                              << "but" << deviceLocationMap.size() << "instances are mapped";
+        consistent = false;
     }
 
+    return consistent;
+
 }
 
-void SDLEventLoop::start() {
-    sdlPollTimer.start();
+void SDLEventLoop::detachVirtualJoysticks( const int count ) {
+
+    // The removal is picked up by handleEvents() on the next poll.
+    for( int i = 0; i < count && !virtualJoysticks.isEmpty(); ++i ) {
+        delete virtualJoysticks.takeLast();
+    }
+
 }
 
-void SDLEventLoop::stop() {
-    sdlPollTimer.stop();
+bool SDLEventLoop::isKnownDevice( const int which ) const {
+    SDL_JoystickID id = SDL_JoystickGetDeviceInstanceID( which );
+    return deviceLocationMap.contains( id ) || pendingDevices.contains( id );
+}
+
+void SDLEventLoop::openDevice( const int which ) {
+
+    // Device indices shift whenever a device is removed, so the device is tracked by its instance ID
+    // until it has a slot of its own.
+    SDL_JoystickID id = SDL_JoystickGetDeviceInstanceID( which );
+
+    if( id < 0 ) {
+        return;
+    }
+
+    auto *joystick = new Joystick( which );
+
+    // Copies, the worker never touches the Joystick or SDL.
+    QString guid = joystick->guid();
+    QByteArray sdlMapping = joystick->sdlMappingString();
+
+    auto *watcher = new QFutureWatcher<Joystick::ResolvedMapping>( this );
+    pendingDevices.insert( id, PendingDevice { joystick, watcher } );
+
+    // The watcher lives in this thread, so publishDevice() runs between two polls.
+    connect( watcher, &QFutureWatcher<Joystick::ResolvedMapping>::finished, this, [ this, watcher, joystick, id ] {
+        pendingDevices.remove( id );
+        watcher->deleteLater();
+        joystick->setResolvedMapping( watcher->result() );
+        publishDevice( joystick );
+    } );
+
+    watcher->setFuture( QtConcurrent::run( [ guid, sdlMapping ] {
+        return Joystick::resolveMapping( guid, sdlMapping );
+    } ) );
+
+}
+
+void SDLEventLoop::publishDevice( Joystick *joystick ) {
+
+    // The device may have been unplugged while its mapping was resolved. Its removal event was ignored
+    // because it wasn't in the deviceLocationMap yet.
+    if( SDL_GameControllerGetAttached( joystick->sdlDevice() ) == SDL_FALSE ) {
+        qCDebug( phxInput ) << "Controller" << joystick->instanceID() << "was removed while it was being opened";
+        joystick->deleteLater();
+        return;
+    }
+
+    int slot = sdlDeviceList.indexOf( nullptr );
+
+    if( slot == -1 ) {
+        qCWarning( phxInput ) << "No free slot for controller" << joystick->instanceID() << ", ignored";
+        joystick->deleteLater();
+        return;
+    }
+
+    joystick->setSDLIndex( slot );
+    joystick->setEventQueues( frontendQueue, editModeQueue );
+    joystick->moveToThread( deviceThread );
+
+    deviceLocationMap.insert( joystick->instanceID(), slot );
+
+    sdlDeviceList[ slot ] = joystick;
+    addActiveJoystick( joystick );
+
+    emit deviceConnected( joystick );
+
+}
+
+void SDLEventLoop::addActiveJoystick( Joystick *joystick ) {
+    Q_ASSERT( activeJoysticks.size() < Joystick::maxNumOfDevices );
+    activeJoysticks.append( joystick );
+}
+
+void SDLEventLoop::removeActiveJoystick( Joystick *joystick ) {
+
+    int index = activeJoysticks.indexOf( joystick );
+
+    if( index == -1 ) {
+        return;
+    }
+
+    activeJoysticks[ index ] = activeJoysticks.last();
+    activeJoysticks.removeLast();
+
 }
 
 void SDLEventLoop::initSDL() {
@@ -280,6 +441,12 @@ void SDLEventLoop::initSDL() {
     // Allow game controller event states to be automatically updated.
     SDL_GameControllerEventState( SDL_ENABLE );
 
+    // The event queue is drained every tick, don't fill it with motion the poll reads anyway.
+    SDL_EventState( SDL_JOYAXISMOTION, SDL_IGNORE );
+    SDL_EventState( SDL_JOYBALLMOTION, SDL_IGNORE );
+    SDL_EventState( SDL_JOYHATMOTION, SDL_IGNORE );
+    SDL_EventState( SDL_CONTROLLERAXISMOTION, SDL_IGNORE );
+
 }
 
 void SDLEventLoop::quitSDL() {
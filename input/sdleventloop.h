@@ -4,35 +4,83 @@
 #include <QObject>
 #include <QTimer>
 #include <QThread>
-#include <QMutex>
 #include <QHash>
+#include <QFutureWatcher>
+#include <QVector>
 #include <SDL.h>
 
+#include <atomic>
+
 #include "joystick.h"
+#include "controllerdb.h"
+#include "virtualjoystick.h"
 
 // The SDLEventLoop's job is to poll for button states,
 // and to react the handle to newly connected, or disconnected, devices.
 
+// The SDLEventLoop is moved into the InputManager's InputThread, so the start(), stop() and
+// setPollRate() slots must be invoked through a queued connection from any other thread.
+
 class SDLEventLoop : public QObject {
         Q_OBJECT
         QTimer sdlPollTimer;
-        int numOfDevices;
-        QMutex sdlEventMutex;
 
-        bool forceEventsHandling;
+        // Newly created Joysticks are moved to this thread, which is the thread
+        // the SDLEventLoop was constructed in (the InputManager's thread).
+        QThread *deviceThread;
 
         // The InputManager is in charge of deleting these devices.
         // The InputManager gains access to these devices by the
         // deviceConnected( Joystick * ) signal.
 
-        // Also for this list, make use of the 'which' index, for
-        // proper insertions and retrievals.
+        // This list is indexed by slot, which is also the Joystick's sdlIndex(). The deviceLocationMap
+        // maps instance IDs to slots.
         QList<Joystick *> sdlDeviceList;
         QHash<int, int> deviceLocationMap;
 
+        // Longest pollEvents() since the last resetTickStats(), in nanoseconds. Read from any thread.
+        std::atomic<qint64> maxTick;
+
+        // Every connected Joystick, packed at the front so the poll loop can walk it without allocating.
+        // Order doesn't matter, removal swaps the last entry into the hole.
+        QVector<Joystick *> activeJoysticks;
+
+        // Handed to every new Joystick, see setEventQueues().
+        InputEventQueue *frontendQueue;
+        InputEventQueue *editModeQueue;
+
+        // Joysticks whose mapping is being resolved in the background, by instance ID.
+        struct PendingDevice {
+            Joystick *joystick;
+            QFutureWatcher<Joystick::ResolvedMapping> *watcher;
+        };
+
+        QHash<SDL_JoystickID, PendingDevice> pendingDevices;
+
+        // Software devices plugged in by attachVirtualJoysticks(), oldest first.
+        QList<VirtualJoystick *> virtualJoysticks;
+
     public:
 
+        static const int defaultPollRate;
+
         explicit SDLEventLoop( QObject *parent = 0 );
+        ~SDLEventLoop();
+
+        // In Hz.
+        int pollRate() const;
+
+        // Every Joystick published from now on sends its events into these. Call this before the
+        // SDLEventLoop is moved to its thread.
+        void setEventQueues( InputEventQueue *frontend, InputEventQueue *editMode );
+
+        // Safe to call from any thread.
+        qint64 maxTickDuration() const;
+        void resetTickStats();
+
+        // Only touch these from the SDLEventLoop's thread.
+        int virtualJoystickCount() const;
+        VirtualJoystick *virtualJoystick( const int index ) const;
 
     public slots:
 
@@ -41,13 +89,46 @@ class SDLEventLoop : public QObject {
         void start();
         void stop();
 
+        void setPollRate( const int rate );
+
+        // Plug in, or pull out the most recently plugged in, 'count' VirtualJoysticks. They show up and
+        // disappear through deviceConnected() and deviceRemoved(), like any other controller.
+        void attachVirtualJoysticks( const int count );
+        void detachVirtualJoysticks( const int count );
+
+        // Checks that the deviceLocationMap, the slots and the poll list all agree on which Joysticks
+        // are connected. Every mismatch is logged.
+        bool verifyConsistency() const;
+
     signals:
 
         void deviceConnected( Joystick *joystick );
         void deviceRemoved( int which );
 
+        // Emitted at the end of every pollEvents(), from the thread that ran it.
+        void polled();
+
     private:
 
+        // Hotplug and edit mode events.
+        void handleEvents();
+
+        // Sample every attached device that isn't in edit mode.
+        void pollDevices();
+
+        // The device is opened right here, SDL isn't guaranteed to cope with that happening on another thread.
+        // Resolving its mapping through the ProfileStore and the ControllerDB is slow enough to cause a hitch,
+        // so that part is done on a worker thread. publishDevice() then gives the Joystick the first free slot
+        // and makes it visible to the poll loop in one step.
+        void openDevice( const int which );
+        void publishDevice( Joystick *joystick );
+
+        // True if the device at index 'which' is either connected or still being opened.
+        bool isKnownDevice( const int which ) const;
+
+        void addActiveJoystick( Joystick *joystick );
+        void removeActiveJoystick( Joystick *joystick );
+
         void initSDL();
         void quitSDL();
 
@@ -0,0 +1,90 @@
+#ifndef SEQLOCK_H
+#define SEQLOCK_H
+
+#include <QtGlobal>
+
+#include <atomic>
+#include <cstring>
+
+// SeqLock publishes a small, trivially copyable value from a single writer thread to any number of
+// reader threads without taking a lock.
+
+// The writer bumps the sequence number to an odd value, writes the value and bumps it back to an even one.
+// Readers copy the value out and retry if the sequence number was odd or changed underneath them. Writers
+// never wait on readers, and readers only spin while a write is actually in progress.
+
+// The value is kept as an array of atomic words, so a reader racing a writer is never a data race,
+// just a retry.
+
+template<typename T>
+class SeqLock {
+
+    public:
+
+        SeqLock()
+            : sequence( 0 ) {
+            for( auto &word : words ) {
+                word.store( 0, std::memory_order_relaxed );
+            }
+        }
+
+        explicit SeqLock( const T &value )
+            : SeqLock() {
+            store( value );
+        }
+
+        // Only ever call this from one thread at a time.
+        void store( const T &value ) {
+
+            quint64 buffer[ wordCount ] = {};
+            std::memcpy( buffer, &value, sizeof( T ) );
+
+            unsigned seq = sequence.load( std::memory_order_relaxed );
+            sequence.store( seq + 1, std::memory_order_relaxed );
+            std::atomic_thread_fence( std::memory_order_release );
+
+            for( int i = 0; i < wordCount; ++i ) {
+                words[ i ].store( buffer[ i ], std::memory_order_relaxed );
+            }
+
+            sequence.store( seq + 2, std::memory_order_release );
+
+        }
+
+        T load() const {
+
+            quint64 buffer[ wordCount ];
+            unsigned before;
+            unsigned after;
+
+            do {
+
+                before = sequence.load( std::memory_order_acquire );
+
+                for( int i = 0; i < wordCount; ++i ) {
+                    buffer[ i ] = words[ i ].load( std::memory_order_relaxed );
+                }
+
+                std::atomic_thread_fence( std::memory_order_acquire );
+                after = sequence.load( std::memory_order_relaxed );
+
+            } while( ( before & 1 ) || before != after );
+
+            T value;
+            std::memcpy( &value, buffer, sizeof( T ) );
+            return value;
+
+        }
+
+    private:
+
+        static const int wordCount = ( sizeof( T ) + sizeof( quint64 ) - 1 ) / sizeof( quint64 );
+
+        std::atomic<unsigned> sequence;
+        std::atomic<quint64> words[ wordCount ];
+
+        Q_DISABLE_COPY( SeqLock )
+
+};
+
+#endif // SEQLOCK_H
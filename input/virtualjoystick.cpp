@@ -0,0 +1,127 @@
+#include "virtualjoystick.h"
+
+#include "logging.h"
+
+#include <QByteArray>
+
+VirtualJoystick::VirtualJoystick()
+    : handle( nullptr ),
+      id( -1 ) {
+
+}
+
+VirtualJoystick::~VirtualJoystick() {
+    detach();
+}
+
+bool VirtualJoystick::isSupported() {
+#if SDL_VERSION_ATLEAST( 2, 0, 14 )
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool VirtualJoystick::attach() {
+
+#if SDL_VERSION_ATLEAST( 2, 0, 14 )
+
+    if( isAttached() ) {
+        return true;
+    }
+
+    int index = SDL_JoystickAttachVirtual( SDL_JOYSTICK_TYPE_GAMECONTROLLER, SDL_CONTROLLER_AXIS_MAX,
+                                           SDL_CONTROLLER_BUTTON_MAX, 0 );
+
+    if( index < 0 ) {
+        qCWarning( phxInput ) << "Unable to attach a virtual joystick:" << SDL_GetError();
+        return false;
+    }
+
+    // Every virtual joystick has the same GUID, so adding the mapping again just replaces it.
+    char guid[ 33 ];
+    SDL_JoystickGetGUIDString( SDL_JoystickGetDeviceGUID( index ), guid, sizeof( guid ) );
+
+    QByteArray mapping = QByteArray( guid ) + ",Virtual Joystick,"
+                         "a:b0,b:b1,x:b2,y:b3,back:b4,guide:b5,start:b6,leftstick:b7,rightstick:b8,"
+                         "leftshoulder:b9,rightshoulder:b10,dpup:b11,dpdown:b12,dpleft:b13,dpright:b14,"
+                         "leftx:a0,lefty:a1,rightx:a2,righty:a3,lefttrigger:a4,righttrigger:a5,";
+
+    SDL_GameControllerAddMapping( mapping.constData() );
+
+    handle = SDL_JoystickOpen( index );
+
+    if( !handle ) {
+        qCWarning( phxInput ) << "Unable to open a virtual joystick:" << SDL_GetError();
+        SDL_JoystickDetachVirtual( index );
+        return false;
+    }
+
+    id = SDL_JoystickInstanceID( handle );
+    return true;
+
+#else
+    qCWarning( phxInput ) << "Virtual joysticks need SDL 2.0.14 or newer";
+    return false;
+#endif
+
+}
+
+void VirtualJoystick::detach() {
+
+#if SDL_VERSION_ATLEAST( 2, 0, 14 )
+
+    if( !isAttached() ) {
+        return;
+    }
+
+    SDL_JoystickClose( handle );
+    handle = nullptr;
+
+    // Device indices shift as devices come and go, find ours again.
+    for( int i = 0; i < SDL_NumJoysticks(); ++i ) {
+        if( SDL_JoystickGetDeviceInstanceID( i ) == id ) {
+            SDL_JoystickDetachVirtual( i );
+            break;
+        }
+    }
+
+    id = -1;
+
+#endif
+
+}
+
+bool VirtualJoystick::isAttached() const {
+    return handle != nullptr;
+}
+
+SDL_JoystickID VirtualJoystick::instanceID() const {
+    return id;
+}
+
+void VirtualJoystick::setButton( const SDL_GameControllerButton button, const bool pressed ) {
+
+#if SDL_VERSION_ATLEAST( 2, 0, 14 )
+    if( handle ) {
+        SDL_JoystickSetVirtualButton( handle, button, pressed ? SDL_PRESSED : SDL_RELEASED );
+    }
+#else
+    Q_UNUSED( button );
+    Q_UNUSED( pressed );
+#endif
+
+}
+
+void VirtualJoystick::setAxis( const SDL_GameControllerAxis axis, const qint16 value ) {
+
+#if SDL_VERSION_ATLEAST( 2, 0, 14 )
+    if( handle ) {
+        SDL_JoystickSetVirtualAxis( handle, axis, value );
+    }
+#else
+    Q_UNUSED( axis );
+    Q_UNUSED( value );
+#endif
+
+}
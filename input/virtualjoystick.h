@@ -0,0 +1,50 @@
+#ifndef VIRTUALJOYSTICK_H
+#define VIRTUALJOYSTICK_H
+
+#include <QtGlobal>
+
+#include "SDL.h"
+#include "SDL_gamecontroller.h"
+
+// VirtualJoystick plugs a game controller that only exists in software into SDL, through SDL's virtual
+// joystick API. The SDLEventLoop sees it being connected and removed just like real hardware, and it's
+// opened and polled by a normal Joystick. Its buttons and axes are set with setButton() and setAxis().
+
+// This lets CI boxes with no controllers exercise hotplug and the poll loop with up to
+// Joystick::maxNumOfDevices pads. It needs SDL 2.0.14 or newer, isSupported() says whether it's available.
+
+class VirtualJoystick {
+
+    public:
+
+        VirtualJoystick();
+
+        // Detaches the device if it's still attached.
+        ~VirtualJoystick();
+
+        static bool isSupported();
+
+        // Connects the device. Buttons and axes are laid out in SDL_GameControllerButton and
+        // SDL_GameControllerAxis order, a matching mapping is registered with SDL.
+        bool attach();
+
+        // Disconnects the device.
+        void detach();
+
+        bool isAttached() const;
+        SDL_JoystickID instanceID() const;
+
+        void setButton( const SDL_GameControllerButton button, const bool pressed );
+        void setAxis( const SDL_GameControllerAxis axis, const qint16 value );
+
+    private:
+
+        // Our own handle to the device, the Joystick opens a separate one.
+        SDL_Joystick *handle;
+        SDL_JoystickID id;
+
+        Q_DISABLE_COPY( VirtualJoystick )
+
+};
+
+#endif // VIRTUALJOYSTICK_H